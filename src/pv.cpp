@@ -8,6 +8,7 @@
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
 #include <ShellAPI.h>
+#include <WinIoCtl.h>
 #include <intrin.h>
 
 static const double update = 0.3333;
@@ -16,20 +17,122 @@ static const double update = 0.3333;
 /* Global buffer                                                           */
 /* ======================================================================= */
 
-#define BUFFSIZE 1048576U
-#define SLOT_COUNT 32U
+#define DEFAULT_CHUNK_SIZE 1048576
+#define LATENCY_CHUNK_SIZE 4096
+#define DEFAULT_RING_SIZE 33554432
+#define MIN_CHUNK_SIZE 512U
+#define MIN_SLOT_COUNT 64U
+#define MAX_SLOT_COUNT 1048576U
+#define CACHE_LINE 64U
 
 static HANDLE g_stopping = NULL;
-static HANDLE g_slots_free = NULL;
-static HANDLE g_slots_used = NULL;
+static volatile HANDLE g_thread_read = NULL;
 
-static CRITICAL_SECTION lock[SLOT_COUNT];
-static DWORD buffer_len[SLOT_COUNT];
-static BYTE buffer[SLOT_COUNT][BUFFSIZE];
+typedef struct __declspec(align(CACHE_LINE)) ring_cursor_t
+{
+	volatile LONG position;
+	volatile ULONG_PTR bytes;
+	volatile ULONG_PTR view_bytes; /*mapped input, not stored in the ring*/
+	volatile LONG waiting;
+	volatile LONG64 stall_ticks;
+	HANDLE wakeup;
+	bool draining; /*watermark state, owned by the consumer*/
+	DWORD spin_limit;
+}
+ring_cursor_t;
+
+static ring_cursor_t g_producer, g_consumer; /*the consumer cursor trails the slowest output*/
+
+#define MAX_OUTPUTS 16U
+
+typedef struct output_t
+{
+	ring_cursor_t cursor;
+	HANDLE handle, thread;
+	const WCHAR *name;
+	volatile LONG active;
+	LONG64 bytes_written;
+	LONG64 next_time;
+	struct trace_t *trace;
+	struct digest_t *digest;
+	struct sparse_t *sparse;
+	struct content_t *content;
+}
+output_t;
+
+static output_t g_outputs[MAX_OUTPUTS];
+static DWORD g_output_count = 0U;
+static CRITICAL_SECTION g_collect_lock;
 
-#define INCREMENT(X) do { (X) = ((X) + 1U) % SLOT_COUNT; } while(0)
+typedef struct slot_t
+{
+	const BYTE *ptr;
+	LPVOID view;
+	DWORD len;
+	LONG64 time; /*when the read completed, for the hand-off latency*/
+}
+slot_t;
+
+static slot_t *g_slots = NULL;
+static DWORD g_slot_count = 0U;
+static LONG g_collect_slot = 0L; /*next slot to be collected, trails the consumer cursor*/
+
+static BYTE *g_ring_base = NULL;
+static HANDLE g_ring_mapping = NULL;
+
+#define INCREMENT(X) do { (X) = ((X) + 1U) % g_slot_count; } while(0)
 
 static volatile LONG64 g_bytes_transferred = 0ULL;
+static LONG64 g_input_size = -1LL;
+static bool g_force_copy = false;
+static LARGE_INTEGER g_perf_freq;
+
+/* ======================================================================= */
+/* Options                                                                 */
+/* ======================================================================= */
+
+#define DEFAULT_COALESCE_TIME 50U
+#define DEFAULT_STATUS_INTERVAL 2500U
+#define MIN_STATUS_INTERVAL 10U
+#define DEFAULT_RECORD_INTERVAL 50U
+
+typedef struct options_t
+{
+	DWORD chunk_size;
+	ULONG_PTR ring_size;
+	bool large_pages;
+	bool lock_memory;
+	DWORD queue_depth;
+	bool direct_io;
+	DWORD coalesce_size;
+	DWORD coalesce_time;
+	bool trace;
+	DWORD status_interval;
+	const WCHAR *stats_file;
+	DWORD stats_format;
+	const WCHAR *record_file;
+	DWORD record_interval;
+	ULONG64 input_size;
+	ULONG64 rate_limit;
+	const WCHAR *outputs[MAX_OUTPUTS];
+	DWORD output_count;
+	DWORD drop_time;
+	DWORD digests;
+	const WCHAR *digest_file;
+	bool count_records;
+	BYTE delimiter;
+	ULONG64 record_limit;
+	bool sparse;
+	bool entropy;
+	DWORD high_mark, low_mark;
+	bool low_latency;
+	DWORD cpus[2U], cpu_count;
+	DWORD numa_node;
+	bool realtime;
+}
+options_t;
+
+static options_t g_options;
 
 /* ======================================================================= */
 /* Text output                                                             */
@@ -43,7 +146,7 @@ static __inline BOOL print_text(const HANDLE output, const CHAR *const text)
 
 static __inline BOOL print_text_fmt(const HANDLE output, const CHAR *const format, ...)
 {
-	CHAR temp[256U];
+	CHAR temp[1024U]; /*wvsprintfA() may write up to 1024 bytes*/
 	BOOL result = FALSE;
 	va_list ap;
 	va_start(ap, format);
@@ -56,328 +159,3977 @@ static __inline BOOL print_text_fmt(const HANDLE output, const CHAR *const forma
 }
 
 /* ======================================================================= */
-/* Environment                                                             */
+/* Clock                                                                   */
 /* ======================================================================= */
 
-const WCHAR *const get_env_variable(const WCHAR *const name)
+static __inline LONG64 clock_now(void)
 {
-	static WCHAR env_buffer[256U];
-	const DWORD ret = GetEnvironmentVariableW(name, env_buffer, 256U);
-	return ((ret > 0U) && (ret < 256U)) ? env_buffer : NULL;
+	LARGE_INTEGER counter;
+	return QueryPerformanceCounter(&counter) ? counter.QuadPart : 0LL;
+}
+
+static __inline LONG64 clock_ticks(const DWORD msec)
+{
+	return (g_perf_freq.QuadPart * msec) / 1000LL;
 }
 
 /* ======================================================================= */
-/* Math                                                                    */
+/* Ring synchronization                                                    */
 /* ======================================================================= */
 
-static __inline LONG round(const double d)
+static __forceinline LONG ring_used(const ring_cursor_t *const consumer = &g_consumer)
 {
-	return (d >= double(0.0)) ? LONG(d + double(0.5)) : LONG(d - LONG(d-1) + double(0.5)) + LONG(d-1);
+	return (LONG)(((DWORD)g_producer.position) - ((DWORD)consumer->position));
 }
 
-static __inline LONG64 round64(const double d)
+static __forceinline ULONG_PTR ring_bytes(const ring_cursor_t *const consumer = &g_consumer)
 {
-	return (d >= double(0.0)) ? LONG64(d + double(0.5)) : LONG64(d - double(LONG64(d-1)) + double(0.5)) + LONG64(d-1);
+	return g_producer.bytes - consumer->bytes;
 }
 
-static __inline DWORD bound(const DWORD min_val, const DWORD val, const DWORD max_val)
+static __forceinline ULONG_PTR ring_views(void)
 {
-	return (val < min_val) ? min_val : ((val > max_val) ? max_val : val);
+	return g_producer.view_bytes - g_consumer.view_bytes;
 }
 
-/* ======================================================================= */
-/* Formatting                                                              */
-/* ======================================================================= */
+static __forceinline ULONG_PTR ring_space(void)
+{
+	const ULONG_PTR used = ring_bytes() + ring_views(); /*mapped views count against the buffer size too*/
+	return (used < g_options.ring_size) ? (g_options.ring_size - used) : 0U;
+}
 
-typedef struct number_t
+static __forceinline DWORD ring_level(const ring_cursor_t *const consumer)
 {
-	DWORD value;
-	DWORD fract;
-	DWORD unit;
+	const DWORD level_bytes = (DWORD) min((((ULONG64)(ring_bytes(consumer) + ring_views())) * 100U) / g_options.ring_size, 100U); /*mapped views fill the buffer just like copied data*/
+	const DWORD level_slots = (DWORD)((((ULONG64)ring_used(consumer)) * 100U) / g_slot_count);
+	return max(level_bytes, level_slots);
 }
-number_t;
 
-static const char *const SIZE_UNITS[] =
+static __forceinline bool ring_accepting(void)
 {
-	"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB", "ZiB", "YiB", NULL
-};
+	return (!g_options.high_mark) || (ring_level(&g_consumer) < g_options.high_mark);
+}
 
-static number_t convert(LONG64 value)
+static bool ring_flowing(ring_cursor_t *const consumer)
 {
-	number_t result;
-	DWORD fract = result.unit = 0U;
-	while((!result.unit) || (value >= 1024U))
+	if(!g_options.high_mark)
 	{
-		++result.unit;
-		fract = (DWORD)(value % 1024U);
-		value /= 1024U;
+		return true;
 	}
-	result.value = (DWORD)value;
-	result.fract = bound(0U, round((static_cast<double>(fract) / 1024.0) * 1000.0), 999U);
-	return result;
+	if(consumer->draining && (ring_level(consumer) > g_options.low_mark))
+	{
+		return true; /*keep draining until the backlog is down to the low mark*/
+	}
+	consumer->draining = (ring_level(&g_consumer) >= g_options.high_mark) || (ring_space() < min(g_options.chunk_size, g_options.ring_size)) || (WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0);
+	return consumer->draining; /*start at the high mark (the reader is paused there), when no further chunk fits or once the input has ended*/
 }
 
-static CHAR *format(CHAR *const buffer, const LONG64 value)
+static __forceinline bool ring_ready(const bool producer, const ULONG_PTR min_bytes, ring_cursor_t *const consumer)
 {
-	const number_t number = convert(value);
-	if((number.unit > 0U) && (number.value < 1000U))
+	if(producer)
 	{
-		if(number.value >= 100U)
-		{
-			wsprintfA(buffer, "%ld.%01ld %s", number.value, number.fract / 100U, SIZE_UNITS[number.unit]);
-		}
-		else if (number.value >= 10U)
-		{
-			wsprintfA(buffer, "%ld.%02ld %s", number.value, number.fract / 10U, SIZE_UNITS[number.unit]);
-		}
-		else
+		return (ring_used() < (LONG)g_slot_count) && (ring_space() > 0U) && (ring_space() >= min_bytes) && ring_accepting(); /*min_bytes is the free space the producer needs*/
+	}
+	return (min_bytes ? ((ring_bytes(consumer) >= min_bytes) || (ring_used(consumer) >= (LONG)g_slot_count)) : (ring_used(consumer) > 0L)) && ring_flowing(consumer); /*don't hold out for more bytes once the reader has run out of slots*/
+}
+
+static __forceinline void ring_publish(ring_cursor_t *const self, ring_cursor_t *const other, const LONG count, const ULONG_PTR bytes)
+{
+	InterlockedExchangeAdd(&self->position, count);
+	self->bytes += bytes; /*byte count never runs ahead of the slot count*/
+	MemoryBarrier();
+	if(other->waiting && InterlockedExchange(&other->waiting, 0L))
+	{
+		SetEvent(other->wakeup);
+	}
+}
+
+static __forceinline void ring_produce(const LONG count, const ULONG_PTR bytes)
+{
+	InterlockedExchangeAdd(&g_producer.position, count);
+	g_producer.bytes += bytes;
+	MemoryBarrier();
+	for(DWORD index = 0U; index < g_output_count; ++index)
+	{
+		ring_cursor_t *const cursor = &g_outputs[index].cursor;
+		if(cursor->waiting && InterlockedExchange(&cursor->waiting, 0L))
 		{
-			wsprintfA(buffer, "%ld.%03ld %s", number.value, number.fract, SIZE_UNITS[number.unit]);
+			SetEvent(cursor->wakeup);
 		}
 	}
-	else
+}
+
+static __inline void release_view(const DWORD slot_index)
+{
+	if(g_slots[slot_index].view)
 	{
-		wsprintfA(buffer, "%ld %s", number.value, SIZE_UNITS[number.unit]);
+		UnmapViewOfFile(g_slots[slot_index].view);
+		g_slots[slot_index].view = NULL;
 	}
-	return buffer;
 }
 
-/* ======================================================================= */
-/* I/O functions                                                           */
-/* ======================================================================= */
-
-static DWORD read_chunk(const HANDLE handle, const bool is_pipe, BYTE *const data_out)
+static void ring_collect(void)
 {
-	DWORD bytes_read = 0U, sleep_timeout = 0U;
-	for(;;)
+	LONG advance = MAXLONG;
+	ULONG_PTR advance_bytes = MAXULONG_PTR;
+	EnterCriticalSection(&g_collect_lock);
+	for(DWORD index = 0U; index < g_output_count; ++index)
 	{
-		if(ReadFile(handle, data_out, BUFFSIZE, &bytes_read, NULL))
+		const ring_cursor_t *const cursor = &g_outputs[index].cursor;
+		if(g_outputs[index].active)
 		{
-			if(bytes_read > 0U)
-			{
-				return bytes_read;
-			}
-			else if(!is_pipe)
-			{
-				return 0U; /*EOF*/
-			}
+			advance = min(advance, (LONG)(((DWORD)cursor->position) - ((DWORD)g_consumer.position)));
+			advance_bytes = min(advance_bytes, cursor->bytes - g_consumer.bytes);
 		}
-		else
+	}
+	if((advance != MAXLONG) && ((advance > 0L) || (advance_bytes > 0U)))
+	{
+		for(LONG count = 0L; count < advance; ++count)
 		{
-			const DWORD error = GetLastError();
-			if((!is_pipe) || (error != ERROR_NO_DATA))
+			if(g_slots[g_collect_slot].view)
 			{
-				return 0U; /*failed*/
+				g_consumer.view_bytes += g_slots[g_collect_slot].len;
+				release_view(g_collect_slot); /*unmap as soon as every output is done with it*/
 			}
+			INCREMENT(g_collect_slot);
 		}
-		if(sleep_timeout++)
+		ring_publish(&g_consumer, &g_producer, advance, advance_bytes); /*slots are recycled once every output has released them*/
+	}
+	LeaveCriticalSection(&g_collect_lock);
+}
+
+static __forceinline void output_release(output_t *const output, const LONG count, const ULONG_PTR bytes)
+{
+	InterlockedExchangeAdd(&output->cursor.position, count);
+	output->cursor.bytes += bytes;
+	ring_collect();
+}
+
+static void output_drop(output_t *const output)
+{
+	if(InterlockedExchange(&output->active, 0L))
+	{
+		print_text_fmt(GetStdHandle(STD_ERROR_HANDLE), "\nWarning: Output \"%S\" could not keep up and has been dropped!\n", output->name);
+		if(const HANDLE thread = output->thread)
 		{
-			if(WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0)
-			{
-				return 0U; /*stop*/
-			}
-			Sleep(sleep_timeout >> 8);
+			CancelSynchronousIo(thread); /*wake up a blocking WriteFile()*/
 		}
+		SetEvent(output->cursor.wakeup);
+		ring_collect();
 	}
 }
 
-static bool write_chunk(const HANDLE handle, const bool is_pipe, const BYTE *const data, const DWORD data_len)
+static void output_failed(output_t *const output)
 {
-	DWORD bytes_written = 0U, sleep_timeout = 0U;
-	for(DWORD offset = 0U; offset < data_len; offset += bytes_written)
+	if((output != g_outputs) && ((g_options.drop_time > 0U) || (!output->active)))
+	{
+		output_drop(output); /*the other outputs carry on*/
+		return;
+	}
+	SetEvent(g_stopping);
+}
+
+static void ring_drop_slowest(void)
+{
+	for(DWORD index = 1U; index < g_output_count; ++index) /*the primary output is never dropped*/
 	{
-		if(!WriteFile(handle, data + offset, data_len - offset, &bytes_written, NULL))
+		output_t *const output = &g_outputs[index];
+		if(output->active && (!output->digest) && (!output->content) && (output->cursor.position == g_consumer.position) && (output->cursor.bytes == g_consumer.bytes))
 		{
-			return false; /*failed*/
+			output_drop(output);
 		}
-		if(bytes_written < 1U)
+	}
+}
+
+#define SPIN_MIN 64U
+#define SPIN_MAX 65536U
+
+static bool ring_spin(ring_cursor_t *const self, const bool producer, const ULONG_PTR min_bytes)
+{
+	const DWORD spin_limit = max(self->spin_limit, SPIN_MIN);
+	const LONG64 spin_start = clock_now();
+	bool ready = false;
+	for(DWORD round = 0U; (round < spin_limit) && (!ready); ++round)
+	{
+		YieldProcessor();
+		ready = ring_ready(producer, min_bytes, self);
+	}
+	InterlockedExchangeAdd64(&self->stall_ticks, clock_now() - spin_start);
+	self->spin_limit = ready ? min(spin_limit * 2U, SPIN_MAX) : max(spin_limit / 2U, SPIN_MIN); /*park sooner while the peer is idle*/
+	return ready;
+}
+
+static bool ring_wait(ring_cursor_t *const self, const bool producer, const ULONG_PTR min_bytes)
+{
+	const DWORD timeout = (producer && (g_output_count > 1U) && g_options.drop_time) ? g_options.drop_time : INFINITE;
+	while(!ring_ready(producer, min_bytes, self))
+	{
+		if(g_options.low_latency && ring_spin(self, producer, min_bytes))
 		{
-			if(!is_pipe)
+			break; /*no wake-up needed*/
+		}
+		InterlockedExchange(&self->waiting, 1L);
+		if(!ring_ready(producer, min_bytes, self))
+		{
+			const HANDLE handles[] = { self->wakeup, g_stopping };
+			const LONG64 wait_start = clock_now();
+			const DWORD wait_status = WaitForMultipleObjects(2U, handles, FALSE, timeout);
+			InterlockedExchangeAdd64(&self->stall_ticks, clock_now() - wait_start);
+			if(wait_status == WAIT_TIMEOUT)
 			{
-				return false; /*failed*/
+				ring_drop_slowest();
 			}
-			if(sleep_timeout++)
+			else if(wait_status != WAIT_OBJECT_0)
 			{
-				if(WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0)
+				InterlockedExchange(&self->waiting, 0L);
+				if((wait_status != WAIT_OBJECT_0 + 1U) || producer || (!ring_ready(producer, min_bytes, self)))
 				{
-					return 0U; /*stop*/
+					return false; /*stop*/
 				}
-				Sleep(sleep_timeout >> 8);
 			}
 		}
+		InterlockedExchange(&self->waiting, 0L);
 	}
 	return true;
 }
 
 /* ======================================================================= */
-/* Read thread                                                             */
+/* Ring memory                                                             */
 /* ======================================================================= */
 
-static DWORD __stdcall read_thread(const LPVOID param)
+static bool enable_privilege(const WCHAR *const name)
 {
-	LONG slot_index = 0U;
-	const bool is_pipe = (GetFileType((HANDLE)param) == FILE_TYPE_PIPE);
-
-	for(;;)
+	HANDLE token;
+	TOKEN_PRIVILEGES privileges;
+	bool success = false;
+	if(OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
 	{
-		const HANDLE handles[] = { g_slots_free, g_stopping };
-		const DWORD wait_status = WaitForMultipleObjects(2U, handles, FALSE, INFINITE);
-		if(wait_status != WAIT_OBJECT_0)
+		privileges.PrivilegeCount = 1U;
+		privileges.Privileges[0U].Attributes = SE_PRIVILEGE_ENABLED;
+		if(LookupPrivilegeValueW(NULL, name, &privileges.Privileges[0U].Luid))
 		{
-			if(wait_status != WAIT_OBJECT_0 + 1U)
-			{
-				SetEvent(g_stopping);
-			}
-			else
-			{
-				return 0U;
-			}
+			success = AdjustTokenPrivileges(token, FALSE, &privileges, 0U, NULL, NULL) && (GetLastError() == ERROR_SUCCESS);
 		}
+		CloseHandle(token);
+	}
+	return success;
+}
 
-		EnterCriticalSection(&lock[slot_index]);
-
-		if((buffer_len[slot_index] = read_chunk((HANDLE)param, is_pipe, buffer[slot_index])) < 1U)
+static BYTE *ring_map(const HANDLE mapping, const ULONG_PTR size, const ULONG_PTR alignment)
+{
+	for(DWORD retry = 0U; retry < 32U; ++retry)
+	{
+		BYTE *const address = (BYTE*) VirtualAlloc(NULL, 2U * size + alignment, MEM_RESERVE, PAGE_NOACCESS);
+		if(!address)
 		{
-			LeaveCriticalSection(&lock[slot_index]);
-			SetEvent(g_stopping);
-			return 0U;
+			break;
+		}
+		VirtualFree(address, 0U, MEM_RELEASE); /*another thread may grab the range now, so retry*/
+		BYTE *const aligned = (BYTE*)((((ULONG_PTR)address) + (alignment - 1U)) & (~(alignment - 1U)));
+		if(BYTE *const view_lo = (BYTE*) MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0U, 0U, size, aligned))
+		{
+			if(MapViewOfFileEx(mapping, FILE_MAP_ALL_ACCESS, 0U, 0U, size, aligned + size))
+			{
+				return view_lo;
+			}
+			UnmapViewOfFile(view_lo);
 		}
-
-		LeaveCriticalSection(&lock[slot_index]);
-		INCREMENT(slot_index);
-		ReleaseSemaphore(g_slots_used, 1U, NULL);
 	}
+	return NULL;
 }
 
-/* ======================================================================= */
-/* Write thread                                                            */
-/* ======================================================================= */
+#define ALIGN_UP(X, Y) ((((X) + ((Y) - 1U)) / (Y)) * (Y))
 
-static DWORD __stdcall write_thread(const LPVOID param)
+static HANDLE ring_section(const DWORD protect, const ULONG_PTR size)
 {
-	LONG slot_index = 0U;
-	const bool is_pipe = (GetFileType((HANDLE)param) == FILE_TYPE_PIPE);
+	if(g_options.numa_node != NUMA_NO_PREFERRED_NODE)
+	{
+		return CreateFileMappingNumaW(INVALID_HANDLE_VALUE, NULL, protect, (DWORD)(((ULONG64)size) >> 32), (DWORD)size, NULL, g_options.numa_node);
+	}
+	return CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, protect, (DWORD)(((ULONG64)size) >> 32), (DWORD)size, NULL);
+}
 
-	for(;;)
+static BYTE *ring_alloc(ULONG_PTR &size, bool &large_pages, HANDLE &mapping)
+{
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	if(large_pages)
 	{
-		const HANDLE handles[] = { g_slots_used, g_stopping };
-		const DWORD wait_status = WaitForMultipleObjects(2U, handles, FALSE, INFINITE);
-		if(wait_status != WAIT_OBJECT_0)
+		const ULONG_PTR large_page_size = GetLargePageMinimum();
+		if((large_page_size > 0U) && enable_privilege(SE_LOCK_MEMORY_NAME))
 		{
-			if(wait_status == WAIT_OBJECT_0 + 1U)
+			const ULONG_PTR large_size = ALIGN_UP(size, large_page_size);
+			if(mapping = ring_section(PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, large_size))
 			{
-				if(WaitForSingleObject(g_slots_used, 1U) != WAIT_OBJECT_0)
+				if(BYTE *const base = ring_map(mapping, large_size, large_page_size))
 				{
-					return 0U;
+					size = large_size;
+					return base;
 				}
-			}
-			else
-			{
-				SetEvent(g_stopping);
-				return 0U;
+				CloseHandle(mapping);
 			}
 		}
-
-		EnterCriticalSection(&lock[slot_index]);
-
-		if(!write_chunk((HANDLE)param, is_pipe, buffer[slot_index], buffer_len[slot_index]))
+		large_pages = false; /*fall back to normal pages*/
+	}
+	size = ALIGN_UP(size, system_info.dwAllocationGranularity);
+	if(mapping = ring_section(PAGE_READWRITE, size))
+	{
+		if(BYTE *const base = ring_map(mapping, size, system_info.dwAllocationGranularity))
 		{
-			LeaveCriticalSection(&lock[slot_index]);
-			SetEvent(g_stopping);
-			return 0U;
+			return base;
 		}
-
-		InterlockedExchangeAdd64(&g_bytes_transferred, buffer_len[slot_index]);
-
-		LeaveCriticalSection(&lock[slot_index]);
-		INCREMENT(slot_index);
-		ReleaseSemaphore(g_slots_free, 1U, NULL);
+		CloseHandle(mapping);
 	}
+	mapping = NULL;
+	return NULL;
 }
 
-/* ======================================================================= */
-/* Status update                                                           */
-/* ======================================================================= */
-
-static void print_status(const HANDLE std_err, LARGE_INTEGER &time_now, LARGE_INTEGER &time_ref, const LARGE_INTEGER &perf_freq, double &average_rate, LONG64 &bytes_total)
+static bool ring_lock(BYTE *const base, const ULONG_PTR size)
 {
-	char buffer_bytes[32U], buffer_rate[32U];
-	const LONG64 bytes_current = InterlockedExchange64(&g_bytes_transferred, 0LL);
-	if(QueryPerformanceCounter(&time_now))
+	SIZE_T min_size, max_size;
+	if(GetProcessWorkingSetSize(GetCurrentProcess(), &min_size, &max_size))
 	{
-		if(time_now.QuadPart > time_ref.QuadPart)
-		{
-			const double current_rate = static_cast<double>(bytes_current) / (static_cast<double>(time_now.QuadPart - time_ref.QuadPart) / static_cast<double>(perf_freq.QuadPart));
-			average_rate = (average_rate < 0.0) ? current_rate : ((current_rate * update) + (average_rate * (1.0 - update)));
-			print_text_fmt(std_err, "\r%s [%s/s] ", format(buffer_bytes, bytes_total += bytes_current), format(buffer_rate, round64(average_rate)));
-		}
-		time_ref.QuadPart = time_now.QuadPart;
+		SetProcessWorkingSetSize(GetCurrentProcess(), min_size + 2U * size, max_size + 2U * size);
 	}
+	return VirtualLock(base, size) && VirtualLock(base + size, size);
 }
 
-/* ======================================================================= */
-/* Ctrl+C handler routine                                                  */
-/* ======================================================================= */
+static void ring_touch(BYTE *const base, const ULONG_PTR size)
+{
+	SYSTEM_INFO system_info;
+	GetSystemInfo(&system_info);
+	for(ULONG_PTR offset = 0U; offset < size; offset += system_info.dwPageSize)
+	{
+		base[offset] = 0x00; /*fault the pages in now, on the preferred node*/
+	}
+}
 
-BOOL WINAPI ctrl_handler_routine(const DWORD type)
+static void ring_release(BYTE *const base, const ULONG_PTR size, HANDLE &mapping)
 {
-	switch(type)
+	if(base)
 	{
-	case CTRL_C_EVENT:
-	case CTRL_BREAK_EVENT:
-	case CTRL_CLOSE_EVENT:
-	case CTRL_LOGOFF_EVENT:
-	case CTRL_SHUTDOWN_EVENT:
-		if(g_stopping)
-		{
-			SetEvent(g_stopping);
-		}
-		return TRUE;
+		UnmapViewOfFile(base + size);
+		UnmapViewOfFile(base);
+	}
+	if(mapping)
+	{
+		CloseHandle(mapping);
+		mapping = NULL;
 	}
-	return FALSE;
 }
 
 /* ======================================================================= */
-/* Help screen                                                             */
+/* Environment                                                             */
 /* ======================================================================= */
 
-#define __VERSION_STR(X, Y, Z) #X "." #Y "." #Z
-#define _VERSION_STR(X, Y, Z) __VERSION_STR(X, Y, Z)
-#define VERSION_STR _VERSION_STR(PIPEUTILS_VERSION_MAJOR, PIPEUTILS_VERSION_MINOR, PIPEUTILS_VERSION_PATCH)
-
-static void print_help_screen(const HANDLE output)
+const WCHAR *const get_env_variable(const WCHAR *const name)
 {
-	print_text(output, "pv v" VERSION_STR " [" __DATE__ "], by LoRd_MuldeR <MuldeR2@GMX.de>\n\n");
-	print_text(output, "Measure the throughput of a pipe and the amount of data transferred.\n");
-	print_text(output, "Set environment variable PV_FORCE_NOWAIT=1 to force \"async\" mode.\n\n");
+	static WCHAR env_buffer[256U];
+	const DWORD ret = GetEnvironmentVariableW(name, env_buffer, 256U);
+	return ((ret > 0U) && (ret < 256U)) ? env_buffer : NULL;
 }
 
 /* ======================================================================= */
-/* Main                                                                    */
+/* Math                                                                    */
 /* ======================================================================= */
 
-static UINT _main(const int argc, const LPWSTR *const argv)
+static __inline LONG round(const double d)
 {
-	UINT result = 1U;
-	HANDLE thread_read = NULL, thread_write = NULL;
-	LONG64 bytes_total = 0U;
-	DWORD wait_status = WAIT_FAILED;
-	LARGE_INTEGER time_now, time_ref, perf_freq;
-	double average_rate = -1.0;
+	return (d >= double(0.0)) ? LONG(d + double(0.5)) : LONG(d - LONG(d-1) + double(0.5)) + LONG(d-1);
+}
 
-	const HANDLE std_inp = GetStdHandle(STD_INPUT_HANDLE);
-	const HANDLE std_out = GetStdHandle(STD_OUTPUT_HANDLE);
-	const HANDLE std_err = GetStdHandle(STD_ERROR_HANDLE);
+static __inline LONG64 round64(const double d)
+{
+	return (d >= double(0.0)) ? LONG64(d + double(0.5)) : LONG64(d - double(LONG64(d-1)) + double(0.5)) + LONG64(d-1);
+}
 
-	if ((std_inp == INVALID_HANDLE_VALUE) || (std_out == INVALID_HANDLE_VALUE))
+static double log2_approx(const double value)
+{
+	union { double d; ULONG64 u; } bits;
+	bits.d = value;
+	const LONG exponent = (LONG)((bits.u >> 52) & 0x7FFU) - 1023L;
+	bits.u = (bits.u & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL; /*mantissa in [1,2)*/
+	const double u = (bits.d - 1.0) / (bits.d + 1.0), u2 = u * u;
+	double term = u, sum = 0.0;
+	for(DWORD k = 1U; k < 17U; k += 2U)
 	{
-		goto clean_up;
+		sum += term / static_cast<double>(k); /*ln(m) = 2 atanh(u), with u <= 1/3*/
+		term *= u2;
 	}
+	return static_cast<double>(exponent) + (sum * 2.8853900817779268); /*2/ln(2)*/
+}
 
-	for(DWORD slot_index = 0; slot_index < SLOT_COUNT; ++slot_index)
-	{
-		InitializeCriticalSection(&lock[slot_index]);
-	}
+static __inline DWORD bound(const DWORD min_val, const DWORD val, const DWORD max_val)
+{
+	return (val < min_val) ? min_val : ((val > max_val) ? max_val : val);
+}
+
+static __inline ULONG64 add_safe(const ULONG64 a, const ULONG64 b)
+{
+	const ULONG64 t = a + b;
+	return (t < a) ? MAXULONGLONG : t;
+}
+
+static __inline ULONG64 multiply_safe(const ULONG64 a, const ULONG64 b)
+{
+	return (a && (b > MAXULONGLONG / a)) ? MAXULONGLONG : (a * b);
+}
+
+/* ======================================================================= */
+/* CPU features                                                            */
+/* ======================================================================= */
+
+#define CPU_SSE2  0x1U
+#define CPU_SSE42 0x2U
+#define CPU_AVX2  0x4U
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1700)
+#define HAVE_AVX2 1
+#endif
+
+#define MAX_CPUS (sizeof(DWORD_PTR) * 8U)
+
+static DWORD g_cpu_features = 0U;
+
+static void detect_cpu_features(void)
+{
+	int info[4U];
+	__cpuid(info, 0);
+	const int max_leaf = info[0U];
+	if(max_leaf >= 1)
+	{
+		__cpuid(info, 1);
+		g_cpu_features |= (info[3U] & (1 << 26)) ? CPU_SSE2 : 0U;
+		g_cpu_features |= (info[2U] & (1 << 20)) ? CPU_SSE42 : 0U;
+#ifdef HAVE_AVX2
+		if((max_leaf >= 7) && ((info[2U] & 0x18000000) == 0x18000000) && ((_xgetbv(0U) & 0x6U) == 0x6U))
+		{
+			__cpuidex(info, 7, 0);
+			g_cpu_features |= (info[1U] & (1 << 5)) ? CPU_AVX2 : 0U; /*the OS must also save the YMM registers*/
+		}
+#endif
+	}
+}
+
+static void pin_thread(const HANDLE std_err, const HANDLE thread, const DWORD cpu)
+{
+	if(!SetThreadAffinityMask(thread, ((DWORD_PTR)1U) << cpu))
+	{
+		print_text_fmt(std_err, "Warning: Failed to pin a thread to CPU %lu!\n", cpu);
+	}
+}
+
+/* ======================================================================= */
+/* Parse integer                                                           */
+/* ======================================================================= */
+
+static ULONG64 parse_number(const WCHAR *str)
+{
+	bool hex_mode = false;
+	ULONG64 value = 0U;
+	while((*str) && (*str <= 0x20))
+	{
+		++str;
+	}
+	if((str[0U] == L'0') && ((str[1U] == L'x') || (str[1U] == L'X')))
+	{
+		hex_mode = true;
+		str += 2U;
+	}
+	while(*str)
+	{
+		if(*str > 0x20)
+		{
+			if((*str >= L'0') && (*str <= L'9'))
+			{
+				value = add_safe(multiply_safe(value, hex_mode ? 16U : 10U), (*str - L'0'));
+			}
+			else if(hex_mode && (*str >= L'a') && (*str <= L'f'))
+			{
+				value = add_safe(multiply_safe(value, 16U), (*str - L'a') + 10U);
+			}
+			else if(hex_mode && (*str >= L'A') && (*str <= L'F'))
+			{
+				value = add_safe(multiply_safe(value, 16U), (*str - L'A') + 10U);
+			}
+			else if((!hex_mode) && (!str[1U]) && ((*str == L'k') || (*str == L'K')))
+			{
+				value = multiply_safe(value, 1024U); /*KiB suffix*/
+			}
+			else if((!hex_mode) && (!str[1U]) && ((*str == L'm') || (*str == L'M')))
+			{
+				value = multiply_safe(value, 1048576U); /*MiB suffix*/
+			}
+			else if((!hex_mode) && (!str[1U]) && ((*str == L'g') || (*str == L'G')))
+			{
+				value = multiply_safe(value, 1073741824U); /*GiB suffix*/
+			}
+			else
+			{
+				return 0U; /*invalid character!*/
+			}
+			++str;
+		}
+		else
+		{
+			break; /*break at space!*/
+		}
+	}
+	while(*str)
+	{
+		if(*str > 0x20)
+		{
+			return 0U; /*character after space!*/
+		}
+		++str;
+	}
+	return value;
+}
+
+/* ======================================================================= */
+/* Formatting                                                              */
+/* ======================================================================= */
+
+typedef struct number_t
+{
+	DWORD value;
+	DWORD fract;
+	DWORD unit;
+}
+number_t;
+
+static const char *const SIZE_UNITS[] =
+{
+	"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB", "ZiB", "YiB", NULL
+};
+
+static number_t convert(LONG64 value)
+{
+	number_t result;
+	DWORD fract = result.unit = 0U;
+	while((!result.unit) || (value >= 1024U))
+	{
+		++result.unit;
+		fract = (DWORD)(value % 1024U);
+		value /= 1024U;
+	}
+	result.value = (DWORD)value;
+	result.fract = bound(0U, round((static_cast<double>(fract) / 1024.0) * 1000.0), 999U);
+	return result;
+}
+
+static CHAR *format(CHAR *const buffer, const LONG64 value)
+{
+	const number_t number = convert(value);
+	if((number.unit > 0U) && (number.value < 1000U))
+	{
+		if(number.value >= 100U)
+		{
+			wsprintfA(buffer, "%ld.%01ld %s", number.value, number.fract / 100U, SIZE_UNITS[number.unit]);
+		}
+		else if (number.value >= 10U)
+		{
+			wsprintfA(buffer, "%ld.%02ld %s", number.value, number.fract / 10U, SIZE_UNITS[number.unit]);
+		}
+		else
+		{
+			wsprintfA(buffer, "%ld.%03ld %s", number.value, number.fract, SIZE_UNITS[number.unit]);
+		}
+	}
+	else
+	{
+		wsprintfA(buffer, "%ld %s", number.value, SIZE_UNITS[number.unit]);
+	}
+	return buffer;
+}
+
+static CHAR *format_count(CHAR *const buffer, LONG64 value)
+{
+	static const char *const COUNT_UNITS[] = { "", "k", "M", "G", "T", "P", "E" };
+	DWORD unit = 0U, fract = 0U;
+	while((value >= 1000LL) && (unit < ARRAYSIZE(COUNT_UNITS) - 1U))
+	{
+		fract = (DWORD)(value % 1000LL);
+		value /= 1000LL;
+		++unit;
+	}
+	if(unit > 0U)
+	{
+		wsprintfA(buffer, "%ld.%01ld%s", (DWORD)value, fract / 100U, COUNT_UNITS[unit]);
+	}
+	else
+	{
+		wsprintfA(buffer, "%ld", (DWORD) max(0LL, value));
+	}
+	return buffer;
+}
+
+static CHAR *format_int(CHAR *const buffer, const LONG64 value)
+{
+	CHAR temp[24U];
+	ULONG64 remaining = (value < 0LL) ? (0ULL - (ULONG64)value) : (ULONG64)value;
+	DWORD len = 0U, pos = 0U;
+	do
+	{
+		temp[len++] = (CHAR)('0' + (remaining % 10U));
+		remaining /= 10U;
+	}
+	while(remaining > 0U);
+	if(value < 0LL)
+	{
+		buffer[pos++] = '-';
+	}
+	while(len > 0U)
+	{
+		buffer[pos++] = temp[--len];
+	}
+	buffer[pos] = '\0';
+	return buffer;
+}
+
+/* ======================================================================= */
+/* Latency histograms                                                      */
+/* ======================================================================= */
+
+#define HIST_SUB_BITS 3U
+#define HIST_SUB_COUNT (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64U - HIST_SUB_BITS + 1U) * HIST_SUB_COUNT)
+
+typedef struct histogram_t
+{
+	ULONG64 count[HIST_BUCKETS];
+	ULONG64 total, max_value;
+}
+histogram_t;
+
+typedef struct __declspec(align(CACHE_LINE)) trace_t
+{
+	histogram_t latency;
+	histogram_t size;
+}
+trace_t;
+
+#define TRACE_READ  0U
+#define TRACE_WRITE 1U
+
+static trace_t g_trace[2U]; /*each one is updated by a single thread only*/
+static histogram_t g_handoff; /*updated by the primary output only*/
+static volatile LONG g_trace_request = 0L;
+
+static __forceinline DWORD hist_index(const ULONG64 value)
+{
+	DWORD msb;
+	if(value < HIST_SUB_COUNT)
+	{
+		return (DWORD)value;
+	}
+	if(!_BitScanReverse(&msb, (DWORD)(value >> 32)))
+	{
+		_BitScanReverse(&msb, (DWORD)value);
+	}
+	else
+	{
+		msb += 32U;
+	}
+	return ((msb - HIST_SUB_BITS + 1U) * HIST_SUB_COUNT) + ((DWORD)(value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1U));
+}
+
+static __inline ULONG64 hist_value(const DWORD index)
+{
+	if(index < HIST_SUB_COUNT)
+	{
+		return index;
+	}
+	const DWORD shift = (index / HIST_SUB_COUNT) - 1U;
+	return (((ULONG64)(HIST_SUB_COUNT + (index % HIST_SUB_COUNT) + 1U)) << shift) - 1U; /*highest value of the bucket*/
+}
+
+static __forceinline void hist_record(histogram_t *const hist, const ULONG64 value)
+{
+	++hist->count[hist_index(value)];
+	++hist->total;
+	if(value > hist->max_value)
+	{
+		hist->max_value = value;
+	}
+}
+
+static ULONG64 hist_percentile(const histogram_t *const hist, const DWORD permille)
+{
+	const ULONG64 threshold = max((hist->total * permille + 999U) / 1000U, 1U);
+	ULONG64 sum = 0U;
+	for(DWORD index = 0U; index < HIST_BUCKETS; ++index)
+	{
+		if((sum += hist->count[index]) >= threshold)
+		{
+			return min(hist_value(index), hist->max_value);
+		}
+	}
+	return hist->max_value;
+}
+
+static __forceinline LONG64 trace_begin(void)
+{
+	return g_options.trace ? clock_now() : 0LL;
+}
+
+static __forceinline void trace_end(trace_t *const trace, const LONG64 time_start, const DWORD bytes)
+{
+	if(time_start && trace)
+	{
+		hist_record(&trace->latency, clock_now() - time_start);
+		hist_record(&trace->size, bytes);
+	}
+}
+
+static __forceinline LONG64 handoff_stamp(void)
+{
+	return (g_options.low_latency || g_options.trace) ? clock_now() : 0LL;
+}
+
+static __forceinline void handoff_record(const output_t *const output, const LONG slot_index)
+{
+	if((output == g_outputs) && g_slots[slot_index].time)
+	{
+		hist_record(&g_handoff, max(0LL, clock_now() - g_slots[slot_index].time)); /*read complete to write start*/
+	}
+}
+
+static CHAR *format_ticks(CHAR *const buffer, const ULONG64 ticks)
+{
+	const ULONG64 nsec = (ULONG64)((static_cast<double>(ticks) / static_cast<double>(g_perf_freq.QuadPart)) * 1000000000.0), usec = nsec / 1000U;
+	if(usec < 1U)
+	{
+		wsprintfA(buffer, "%lu ns", (DWORD)nsec);
+	}
+	else if(usec < 1000U)
+	{
+		wsprintfA(buffer, "%lu us", (DWORD)usec);
+	}
+	else
+	{
+		wsprintfA(buffer, "%lu.%03lu ms", (DWORD) min(usec / 1000U, MAXDWORD), (DWORD)(usec % 1000U));
+	}
+	return buffer;
+}
+
+static const DWORD TRACE_PERCENTILES[] = { 500U, 900U, 990U, 999U };
+static const char *const TRACE_LABELS[] = { "p50", "p90", "p99", "p99.9" };
+
+static void print_histogram(const HANDLE output, const char *const name, const histogram_t *const hist, const bool is_time)
+{
+	char buffer[32U];
+	print_text_fmt(output, "%s", name);
+	for(DWORD i = 0U; i < ARRAYSIZE(TRACE_PERCENTILES); ++i)
+	{
+		const ULONG64 value = hist_percentile(hist, TRACE_PERCENTILES[i]);
+		print_text_fmt(output, " %s: %s,", TRACE_LABELS[i], is_time ? format_ticks(buffer, value) : format(buffer, value));
+	}
+	print_text_fmt(output, " max: %s\n", is_time ? format_ticks(buffer, hist->max_value) : format(buffer, hist->max_value));
+}
+
+static void print_trace(const HANDLE output)
+{
+	static const char *const NAMES[] = { "Read", "Write" };
+	for(DWORD i = 0U; i < ARRAYSIZE(g_trace); ++i)
+	{
+		if(g_trace[i].latency.total > 0U)
+		{
+			print_text_fmt(output, "%s calls: %lu\n", NAMES[i], (DWORD) min(g_trace[i].latency.total, MAXDWORD));
+			print_histogram(output, "   Latency ->", &g_trace[i].latency, true);
+			print_histogram(output, "   Size    ->", &g_trace[i].size, false);
+		}
+	}
+	if(g_handoff.total > 0U)
+	{
+		print_text_fmt(output, "Hand-offs: %lu\n", (DWORD) min(g_handoff.total, MAXDWORD));
+		print_histogram(output, "   Latency ->", &g_handoff, true);
+	}
+}
+
+/* ======================================================================= */
+/* I/O functions                                                           */
+/* ======================================================================= */
+
+#define MAX_BACKOFF 16U
+
+static __inline bool wait_backoff(DWORD &counter)
+{
+	if(counter < (MAX_BACKOFF << 8))
+	{
+		++counter;
+	}
+	return (counter < 2U) || (WaitForSingleObject(g_stopping, counter >> 8) != WAIT_OBJECT_0);
+}
+
+static DWORD read_chunk(const HANDLE handle, const bool is_pipe, BYTE *const data_out, const DWORD data_len)
+{
+	DWORD bytes_read = 0U, sleep_timeout = 0U;
+	for(;;)
+	{
+		const LONG64 time_start = trace_begin();
+		const BOOL success = ReadFile(handle, data_out, data_len, &bytes_read, NULL);
+		trace_end(&g_trace[TRACE_READ], time_start, bytes_read);
+		if(success)
+		{
+			if(bytes_read > 0U)
+			{
+				return bytes_read;
+			}
+			else if(!is_pipe)
+			{
+				return 0U; /*EOF*/
+			}
+		}
+		else
+		{
+			const DWORD error = GetLastError();
+			if((!is_pipe) || (error != ERROR_NO_DATA))
+			{
+				return 0U; /*failed*/
+			}
+		}
+		if(!wait_backoff(sleep_timeout))
+		{
+			return 0U; /*stop*/
+		}
+	}
+}
+
+static DWORD read_coalesced(const HANDLE handle, const bool is_pipe, BYTE *const data_out, const DWORD data_len)
+{
+	DWORD bytes_total = read_chunk(handle, is_pipe, data_out, data_len);
+	if((bytes_total < 1U) || (!is_pipe) || (bytes_total >= g_options.coalesce_size))
+	{
+		return bytes_total;
+	}
+	const LONG64 deadline = clock_now() + clock_ticks(g_options.coalesce_time);
+	while((bytes_total < g_options.coalesce_size) && (bytes_total < data_len))
+	{
+		DWORD bytes_avail = 0U, bytes_read = 0U;
+		if(!PeekNamedPipe(handle, NULL, 0U, NULL, &bytes_avail, NULL))
+		{
+			break; /*EOF or error will be reported by the next read*/
+		}
+		if(bytes_avail < 1U)
+		{
+			if((clock_now() >= deadline) || (WaitForSingleObject(g_stopping, 1U) == WAIT_OBJECT_0))
+			{
+				break; /*deadline expired*/
+			}
+			continue;
+		}
+		const LONG64 time_start = trace_begin();
+		const BOOL success = ReadFile(handle, data_out + bytes_total, min(bytes_avail, data_len - bytes_total), &bytes_read, NULL);
+		trace_end(&g_trace[TRACE_READ], time_start, bytes_read);
+		if(!success)
+		{
+			break;
+		}
+		bytes_total += bytes_read;
+		if(clock_now() >= deadline)
+		{
+			break;
+		}
+	}
+	return bytes_total;
+}
+
+static bool write_chunk(const HANDLE handle, const bool is_pipe, const BYTE *const data, const DWORD data_len, trace_t *const trace)
+{
+	DWORD bytes_written = 0U, sleep_timeout = 0U;
+	for(DWORD offset = 0U; offset < data_len; offset += bytes_written)
+	{
+		const LONG64 time_start = trace_begin();
+		const BOOL success = WriteFile(handle, data + offset, data_len - offset, &bytes_written, NULL);
+		trace_end(trace, time_start, bytes_written);
+		if(!success)
+		{
+			return false; /*failed*/
+		}
+		if(bytes_written < 1U)
+		{
+			if(!is_pipe)
+			{
+				return false; /*failed*/
+			}
+			if(!wait_backoff(sleep_timeout))
+			{
+				return false; /*stop*/
+			}
+		}
+	}
+	return true;
+}
+
+/* ======================================================================= */
+/* Record counting                                                         */
+/* ======================================================================= */
+
+#define COUNT_BLOCK 65536U
+
+static volatile LONG64 g_records_total = 0LL;
+static bool g_records_done = false;
+
+static SIZE_T count_scalar(const BYTE *const data, const SIZE_T len, const BYTE delimiter)
+{
+	SIZE_T count = 0U;
+	for(SIZE_T i = 0U; i < len; ++i)
+	{
+		count += (data[i] == delimiter) ? 1U : 0U;
+	}
+	return count;
+}
+
+static SIZE_T count_sse2(const BYTE *data, SIZE_T len, const BYTE delimiter)
+{
+	const __m128i needle = _mm_set1_epi8((char)delimiter), zero = _mm_setzero_si128();
+	SIZE_T count = 0U;
+	while(len >= 16U)
+	{
+		SIZE_T rounds = min(len / 16U, 255U); /*a byte lane overflows after 255 matches*/
+		__m128i lanes = zero;
+		for(len -= rounds * 16U; rounds > 0U; --rounds, data += 16U)
+		{
+			lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)data), needle));
+		}
+		const __m128i sums = _mm_sad_epu8(lanes, zero);
+		count += (SIZE_T)_mm_cvtsi128_si32(sums) + (SIZE_T)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+	}
+	return count + count_scalar(data, len, delimiter);
+}
+
+#ifdef HAVE_AVX2
+static SIZE_T count_avx2(const BYTE *data, SIZE_T len, const BYTE delimiter)
+{
+	const __m256i needle = _mm256_set1_epi8((char)delimiter), zero = _mm256_setzero_si256();
+	SIZE_T count = 0U;
+	while(len >= 32U)
+	{
+		SIZE_T rounds = min(len / 32U, 255U);
+		__m256i lanes = zero;
+		for(len -= rounds * 32U; rounds > 0U; --rounds, data += 32U)
+		{
+			lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)data), needle));
+		}
+		const __m256i sums = _mm256_sad_epu8(lanes, zero);
+		const __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		count += (SIZE_T)_mm_cvtsi128_si32(half) + (SIZE_T)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+	}
+	_mm256_zeroupper();
+	return count + count_sse2(data, len, delimiter);
+}
+#endif
+
+static __inline SIZE_T count_delimiters(const BYTE *const data, const SIZE_T len, const BYTE delimiter)
+{
+#ifdef HAVE_AVX2
+	if(g_cpu_features & CPU_AVX2)
+	{
+		return count_avx2(data, len, delimiter);
+	}
+#endif
+	return (g_cpu_features & CPU_SSE2) ? count_sse2(data, len, delimiter) : count_scalar(data, len, delimiter);
+}
+
+static DWORD count_records(const BYTE *const data, const DWORD len)
+{
+	if(!g_options.record_limit)
+	{
+		InterlockedExchangeAdd64(&g_records_total, (LONG64)count_delimiters(data, len, g_options.delimiter));
+		return len;
+	}
+
+	ULONG64 remaining = g_options.record_limit - (ULONG64)g_records_total, counted = 0U;
+	for(DWORD offset = 0U; offset < len; offset += COUNT_BLOCK)
+	{
+		const DWORD block = min(len - offset, COUNT_BLOCK);
+		const SIZE_T count = count_delimiters(data + offset, block, g_options.delimiter);
+		if(count >= remaining)
+		{
+			DWORD position = offset;
+			for(counted += remaining; remaining > 0U; ++position)
+			{
+				remaining -= (data[position] == g_options.delimiter) ? 1U : 0U;
+			}
+			InterlockedExchangeAdd64(&g_records_total, (LONG64)counted);
+			g_records_done = true;
+			return position; /*cut the chunk right after the last wanted delimiter*/
+		}
+		remaining -= count;
+		counted += count;
+	}
+
+	InterlockedExchangeAdd64(&g_records_total, (LONG64)counted);
+	return len;
+}
+
+/* ======================================================================= */
+/* Input files                                                             */
+/* ======================================================================= */
+
+typedef struct input_t
+{
+	const WCHAR *name;
+	HANDLE handle;
+}
+input_t;
+
+static input_t *g_inputs = NULL;
+static DWORD g_input_count = 0U;
+
+typedef struct reader_t
+{
+	LONG slot_index;
+	ULONG_PTR ring_offset;
+}
+reader_t; /*carried over from one input to the next*/
+
+typedef struct memory_range_t
+{
+	PVOID address;
+	SIZE_T size;
+}
+memory_range_t; /*WIN32_MEMORY_RANGE_ENTRY*/
+
+typedef BOOL (WINAPI *prefetch_memory_t)(HANDLE, ULONG_PTR, memory_range_t*, ULONG);
+
+typedef struct prefetch_t
+{
+	prefetch_memory_t prefetch_memory; /*Windows 8 or later*/
+	HANDLE wakeup;
+	volatile LONG next;
+}
+prefetch_t;
+
+static prefetch_t g_prefetch;
+
+static void prefetch_init(void)
+{
+	g_prefetch.next = -1L;
+	if(const HMODULE kernel32 = GetModuleHandleW(L"kernel32.dll"))
+	{
+		g_prefetch.prefetch_memory = (prefetch_memory_t) GetProcAddress(kernel32, "PrefetchVirtualMemory");
+	}
+}
+
+static __inline void prefetch_range(const void *const address, const SIZE_T size)
+{
+	if(g_prefetch.prefetch_memory)
+	{
+		memory_range_t range;
+		range.address = (PVOID)address;
+		range.size = size;
+		g_prefetch.prefetch_memory(GetCurrentProcess(), 1U, &range, 0U);
+	}
+}
+
+static void prefetch_request(const DWORD index)
+{
+	if(g_prefetch.wakeup && (index < g_input_count))
+	{
+		InterlockedExchange(&g_prefetch.next, (LONG)index);
+		SetEvent(g_prefetch.wakeup);
+	}
+}
+
+static void prefetch_file(const HANDLE handle)
+{
+	SYSTEM_INFO system_info;
+	LARGE_INTEGER file_size;
+	if((GetFileType(handle) != FILE_TYPE_DISK) || (!GetFileSizeEx(handle, &file_size)) || (file_size.QuadPart < 1LL))
+	{
+		return;
+	}
+	GetSystemInfo(&system_info);
+	const SIZE_T length = (SIZE_T) min((ULONG64)file_size.QuadPart, (ULONG64)g_options.ring_size); /*as much as the ring can take at once*/
+	if(const HANDLE mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0U, 0U, NULL))
+	{
+		if(const BYTE *const view = (const BYTE*) MapViewOfFile(mapping, FILE_MAP_READ, 0U, 0U, length))
+		{
+			volatile BYTE sink = 0U;
+			prefetch_range(view, length);
+			for(SIZE_T offset = 0U; offset < length; offset += system_info.dwPageSize)
+			{
+				if((!(offset % 1048576U)) && (WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0))
+				{
+					break;
+				}
+				sink ^= view[offset]; /*fault the page into the file cache*/
+			}
+			UnmapViewOfFile(view);
+		}
+		CloseHandle(mapping);
+	}
+}
+
+static DWORD __stdcall prefetch_thread(const LPVOID)
+{
+	const HANDLE handles[] = { g_prefetch.wakeup, g_stopping };
+	while(WaitForMultipleObjects(2U, handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+	{
+		const LONG index = InterlockedExchange(&g_prefetch.next, -1L);
+		if((index >= 0L) && ((DWORD)index < g_input_count))
+		{
+			prefetch_file(g_inputs[index].handle);
+		}
+	}
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Memory-mapped input                                                     */
+/* ======================================================================= */
+
+typedef struct mapped_input_t
+{
+	HANDLE mapping;
+	LONG64 offset;
+	LONG64 size;
+	DWORD granularity;
+}
+mapped_input_t;
+
+static bool mapped_open(mapped_input_t *const input, const HANDLE handle)
+{
+	SYSTEM_INFO system_info;
+	LARGE_INTEGER file_size, file_pos, zero;
+	input->mapping = NULL;
+	zero.QuadPart = 0LL;
+	if((GetFileType(handle) != FILE_TYPE_DISK) || (!GetFileSizeEx(handle, &file_size)) || (!SetFilePointerEx(handle, zero, &file_pos, FILE_CURRENT)))
+	{
+		return false;
+	}
+	if(file_size.QuadPart <= file_pos.QuadPart)
+	{
+		return false; /*nothing to map*/
+	}
+	if(!(input->mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0U, 0U, NULL)))
+	{
+		return false;
+	}
+	GetSystemInfo(&system_info);
+	input->granularity = system_info.dwAllocationGranularity;
+	input->offset = file_pos.QuadPart;
+	input->size = file_size.QuadPart;
+	return true;
+}
+
+static void mapped_close(mapped_input_t *const input, const HANDLE handle)
+{
+	LARGE_INTEGER file_pos;
+	if(input->mapping)
+	{
+		CloseHandle(input->mapping);
+		input->mapping = NULL;
+		file_pos.QuadPart = input->offset;
+		SetFilePointerEx(handle, file_pos, NULL, FILE_BEGIN); /*continue with the copy path*/
+	}
+}
+
+static DWORD mapped_read(mapped_input_t *const input, const HANDLE handle, LPVOID &view, const BYTE *&data_out)
+{
+	if(input->offset < input->size)
+	{
+		const DWORD delta = (DWORD)(input->offset % input->granularity);
+		const LONG64 base = input->offset - delta;
+		const DWORD length = (input->size - input->offset > g_options.chunk_size) ? g_options.chunk_size : (DWORD)(input->size - input->offset);
+		if(view = MapViewOfFile(input->mapping, FILE_MAP_READ, (DWORD)(base >> 32), (DWORD)base, delta + length))
+		{
+			data_out = ((const BYTE*)view) + delta;
+			if(((ULONG64)ring_used()) * g_options.chunk_size <= g_options.ring_size)
+			{
+				prefetch_range(data_out, length); /*read ahead while the view waits in the ring*/
+			}
+			input->offset += length;
+			return length;
+		}
+	}
+	mapped_close(input, handle);
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Overlapped I/O                                                          */
+/* ======================================================================= */
+
+#define MAX_QUEUE_DEPTH 64U
+#define DIRECT_ALIGN 4096U
+
+typedef struct async_io_t
+{
+	HANDLE handle;
+	LONG64 offset;
+	LONG64 done_offset;
+	DWORD depth, head, pending, align;
+	OVERLAPPED request[MAX_QUEUE_DEPTH];
+	const BYTE *data[MAX_QUEUE_DEPTH];
+	DWORD length[MAX_QUEUE_DEPTH];
+	LONG count[MAX_QUEUE_DEPTH];
+	ULONG_PTR ring_bytes[MAX_QUEUE_DEPTH];
+	LONG64 issued[MAX_QUEUE_DEPTH];
+	trace_t *trace;
+}
+async_io_t;
+
+static bool async_open(async_io_t *const io, const HANDLE original, const DWORD access, const bool direct)
+{
+	LARGE_INTEGER file_pos, zero;
+	zero.QuadPart = 0LL;
+	SecureZeroMemory(io, sizeof(async_io_t));
+	if((GetFileType(original) != FILE_TYPE_DISK) || (!SetFilePointerEx(original, zero, &file_pos, FILE_CURRENT)))
+	{
+		return false;
+	}
+	io->align = 1U;
+	if(direct && (!(file_pos.QuadPart % DIRECT_ALIGN)))
+	{
+		if((io->handle = ReOpenFile(original, access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED | FILE_FLAG_NO_BUFFERING)) != INVALID_HANDLE_VALUE)
+		{
+			io->align = DIRECT_ALIGN;
+		}
+	}
+	if(io->align < 2U)
+	{
+		if(!g_options.queue_depth)
+		{
+			return false;
+		}
+		if((io->handle = ReOpenFile(original, access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED | ((access == GENERIC_READ) ? FILE_FLAG_SEQUENTIAL_SCAN : 0U))) == INVALID_HANDLE_VALUE)
+		{
+			return false; /*fall back to synchronous I/O*/
+		}
+	}
+	io->depth = max(1U, g_options.queue_depth);
+	io->offset = io->done_offset = file_pos.QuadPart;
+	io->trace = &g_trace[(access == GENERIC_READ) ? TRACE_READ : TRACE_WRITE];
+	for(DWORD index = 0U; index < io->depth; ++index)
+	{
+		if(!(io->request[index].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)))
+		{
+			io->depth = index;
+			break;
+		}
+	}
+	if(io->depth < 1U)
+	{
+		CloseHandle(io->handle);
+		return false;
+	}
+	return true;
+}
+
+static bool async_submit(async_io_t *const io, const bool write, const BYTE *const data, const DWORD length, const LONG count, const ULONG_PTR ring_bytes)
+{
+	const DWORD index = (io->head + io->pending) % io->depth;
+	OVERLAPPED *const request = &io->request[index];
+	const HANDLE event = request->hEvent;
+	SecureZeroMemory(request, sizeof(OVERLAPPED));
+	request->hEvent = event;
+	request->Offset = (DWORD)io->offset;
+	request->OffsetHigh = (DWORD)(io->offset >> 32);
+	io->issued[index] = trace_begin();
+	const BOOL success = write ? WriteFile(io->handle, data, length, NULL, request) : ReadFile(io->handle, (LPVOID)data, length, NULL, request);
+	if((!success) && (GetLastError() != ERROR_IO_PENDING))
+	{
+		return false; /*failed or EOF*/
+	}
+	io->data[index] = data;
+	io->length[index] = length;
+	io->count[index] = count;
+	io->ring_bytes[index] = ring_bytes;
+	io->offset += length;
+	++io->pending;
+	return true;
+}
+
+static bool async_complete(async_io_t *const io, const bool stoppable, DWORD &index, DWORD &bytes_done)
+{
+	OVERLAPPED *const request = &io->request[index = io->head];
+	if(stoppable)
+	{
+		const HANDLE handles[] = { request->hEvent, g_stopping };
+		if(WaitForMultipleObjects(2U, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+		{
+			return false; /*stop*/
+		}
+	}
+	const BOOL success = GetOverlappedResult(io->handle, request, &bytes_done, TRUE);
+	trace_end(io->trace, io->issued[index], success ? bytes_done : 0U);
+	io->head = (io->head + 1U) % io->depth;
+	--io->pending;
+	if(!success)
+	{
+		bytes_done = 0U;
+		return (GetLastError() == ERROR_HANDLE_EOF);
+	}
+	io->done_offset = (((LONG64)request->OffsetHigh) << 32) + request->Offset + bytes_done;
+	return true;
+}
+
+static void async_close(async_io_t *const io, const HANDLE original)
+{
+	LARGE_INTEGER file_pos;
+	DWORD bytes_done;
+	if(io->pending > 0U)
+	{
+		CancelIo(io->handle);
+		for(; io->pending > 0U; --io->pending)
+		{
+			GetOverlappedResult(io->handle, &io->request[io->head], &bytes_done, TRUE);
+			io->head = (io->head + 1U) % io->depth;
+		}
+	}
+	for(DWORD index = 0U; index < io->depth; ++index)
+	{
+		CloseHandle(io->request[index].hEvent);
+	}
+	CloseHandle(io->handle);
+	file_pos.QuadPart = io->done_offset;
+	SetFilePointerEx(original, file_pos, NULL, FILE_BEGIN); /*keep the inherited handle in sync*/
+}
+
+static void read_async(async_io_t *const io, const HANDLE original, reader_t &reader)
+{
+	ULONG_PTR ring_offset = reader.ring_offset, reserved = 0U;
+	const DWORD chunk_size = (io->align > 1U) ? ALIGN_UP(g_options.chunk_size, io->align) : g_options.chunk_size;
+	bool eof = false;
+
+	for(;;)
+	{
+		while((!eof) && (io->pending < io->depth) && (ring_used() + (LONG)io->pending < (LONG)g_slot_count) && (ring_space() > reserved) && ring_accepting())
+		{
+			const DWORD length = (DWORD) min(ring_space() - reserved, chunk_size) & (~(io->align - 1U));
+			if(length < 1U)
+			{
+				break; /*direct I/O needs an aligned amount of free space*/
+			}
+			if(!async_submit(io, false, g_ring_base + ring_offset, length, 1L, length))
+			{
+				eof = true;
+				break;
+			}
+			ring_offset = (ring_offset + length) % g_options.ring_size;
+			reserved += length;
+		}
+
+		if(io->pending < 1U)
+		{
+			if(eof || (!ring_wait(&g_producer, true, io->align))) /*direct I/O needs at least one aligned block of free space*/
+			{
+				break;
+			}
+			continue;
+		}
+
+		DWORD index, bytes_read = 0U;
+		if((!async_complete(io, true, index, bytes_read)) || (bytes_read < 1U))
+		{
+			break; /*stop, EOF or error*/
+		}
+
+		reserved -= io->length[index];
+		const DWORD bytes_used = g_options.count_records ? count_records(io->data[index], bytes_read) : bytes_read;
+		io->done_offset -= bytes_read - bytes_used; /*the file position goes right behind the last record passed on*/
+		release_view(reader.slot_index); /*a previous input may have left a mapped view in this slot*/
+		g_slots[reader.slot_index].ptr = io->data[index];
+		g_slots[reader.slot_index].len = bytes_used;
+		g_slots[reader.slot_index].time = handoff_stamp();
+		reader.ring_offset = ((io->data[index] - g_ring_base) + bytes_used) % g_options.ring_size; /*the next input continues right here*/
+
+		INCREMENT(reader.slot_index);
+		ring_produce(1L, bytes_used);
+
+		if((bytes_read < io->length[index]) || g_records_done)
+		{
+			break; /*short read means EOF, the remaining requests are discarded*/
+		}
+	}
+
+	async_close(io, original);
+}
+
+/* ======================================================================= */
+/* Read thread                                                             */
+/* ======================================================================= */
+
+static void read_input(const HANDLE handle, reader_t &reader)
+{
+	mapped_input_t input;
+	async_io_t async_io;
+	const bool is_pipe = (GetFileType(handle) == FILE_TYPE_PIPE);
+
+	if(async_open(&async_io, handle, GENERIC_READ, g_options.direct_io && (!(reader.ring_offset % DIRECT_ALIGN))))
+	{
+		read_async(&async_io, handle, reader);
+		return;
+	}
+
+	SecureZeroMemory(&input, sizeof(mapped_input_t)); /*the mapping stays NULL unless mapped_open() succeeds*/
+	if(!(g_force_copy || g_options.direct_io))
+	{
+		mapped_open(&input, handle);
+	}
+
+	while(ring_wait(&g_producer, true, input.mapping ? min(g_options.chunk_size, g_options.ring_size) : 0U))
+	{
+		const LONG slot_index = reader.slot_index;
+		release_view(slot_index);
+
+		if(input.mapping && ((g_slots[slot_index].len = mapped_read(&input, handle, g_slots[slot_index].view, g_slots[slot_index].ptr)) > 0U))
+		{
+			if(g_options.count_records)
+			{
+				const DWORD length = g_slots[slot_index].len;
+				g_slots[slot_index].len = count_records(g_slots[slot_index].ptr, length);
+				input.offset -= length - g_slots[slot_index].len; /*mapped_close() restores the position behind the last record*/
+			}
+			g_slots[slot_index].time = handoff_stamp();
+			g_producer.view_bytes += g_slots[slot_index].len;
+			INCREMENT(reader.slot_index);
+			ring_produce(1L, 0U);
+			if(g_records_done)
+			{
+				break;
+			}
+			continue;
+		}
+
+		BYTE *const data_out = g_ring_base + reader.ring_offset;
+		const DWORD bytes_read = read_coalesced(handle, is_pipe, data_out, (DWORD) min(ring_space(), g_options.chunk_size));
+		if(bytes_read < 1U)
+		{
+			break; /*EOF or error*/
+		}
+
+		const DWORD bytes_used = g_options.count_records ? count_records(data_out, bytes_read) : bytes_read;
+		if((bytes_used < bytes_read) && (GetFileType(handle) == FILE_TYPE_DISK))
+		{
+			LARGE_INTEGER distance;
+			distance.QuadPart = -((LONG64)(bytes_read - bytes_used));
+			SetFilePointerEx(handle, distance, NULL, FILE_CURRENT); /*give the bytes after the last record back*/
+		}
+		g_slots[slot_index].ptr = data_out;
+		g_slots[slot_index].len = bytes_used;
+		g_slots[slot_index].time = handoff_stamp();
+		reader.ring_offset = (reader.ring_offset + bytes_used) % g_options.ring_size;
+
+		INCREMENT(reader.slot_index);
+		ring_produce(1L, bytes_used);
+		if(g_records_done)
+		{
+			break; /*the record limit has been reached*/
+		}
+	}
+
+	mapped_close(&input, handle);
+}
+
+static DWORD __stdcall read_thread(const LPVOID param)
+{
+	reader_t reader = { 0L, 0U };
+
+	if(g_input_count < 1U)
+	{
+		read_input((HANDLE)param, reader);
+		SetEvent(g_stopping);
+		return 0U;
+	}
+
+	for(DWORD index = 0U; index < g_input_count; ++index)
+	{
+		prefetch_request(index + 1U); /*warm up the next file while this one drains*/
+		read_input(g_inputs[index].handle, reader);
+		if(g_records_done || (WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0))
+		{
+			break;
+		}
+	}
+
+	SetEvent(g_stopping);
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Rate limiter                                                            */
+/* ======================================================================= */
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+#define PACE_QUANTUM_MSEC 1U
+#define PACE_SLACK_MSEC 4U
+#define PACE_SPIN_USEC 200U
+
+typedef struct __declspec(align(CACHE_LINE)) limiter_t
+{
+	volatile LONG64 rate; /*bytes per second, zero means unlimited*/
+	HANDLE timer;
+	bool high_resolution;
+	HANDLE pipe;
+	WCHAR pipe_name[64U];
+}
+limiter_t;
+
+static limiter_t g_limiter;
+static volatile LONG g_aborted = 0L;
+
+static __inline LONG64 limiter_rate(void)
+{
+	return InterlockedCompareExchange64(&g_limiter.rate, 0LL, 0LL);
+}
+
+static __inline DWORD limiter_quantum(const LONG64 rate, const DWORD align)
+{
+	const DWORD quantum = (DWORD) max(min((rate * PACE_QUANTUM_MSEC) / 1000LL, MAXLONG), MIN_CHUNK_SIZE);
+	return max(quantum & (~(align - 1U)), align);
+}
+
+static void limiter_sleep(const LONG64 deadline)
+{
+	for(LONG64 time_now = clock_now(); (time_now < deadline) && (!g_aborted); time_now = clock_now())
+	{
+		const LONG64 usec = ((deadline - time_now) * 1000000LL) / g_perf_freq.QuadPart;
+		if(usec > PACE_SPIN_USEC)
+		{
+			if(g_limiter.high_resolution)
+			{
+				LARGE_INTEGER due_time;
+				due_time.QuadPart = -10LL * (usec - PACE_SPIN_USEC);
+				if(SetWaitableTimer(g_limiter.timer, &due_time, 0L, NULL, NULL, FALSE))
+				{
+					WaitForSingleObject(g_limiter.timer, INFINITE);
+					continue;
+				}
+			}
+			if(usec >= 2000LL)
+			{
+				Sleep((DWORD)((usec / 1000LL) - 1LL)); /*coarse system timer, spin for the rest*/
+				continue;
+			}
+		}
+		if(!SwitchToThread())
+		{
+			YieldProcessor();
+		}
+	}
+}
+
+static bool limiter_pace(output_t *const output, const DWORD length)
+{
+	const LONG64 rate = limiter_rate(), time_now = clock_now();
+	if(rate > 0LL)
+	{
+		const LONG64 slack = clock_ticks(PACE_SLACK_MSEC);
+		if(output->next_time < time_now - slack)
+		{
+			output->next_time = time_now - slack; /*idle time earns a few milliseconds of credit at most*/
+		}
+		const LONG64 deadline = output->next_time;
+		output->next_time += (LONG64)((static_cast<double>(length) / static_cast<double>(rate)) * static_cast<double>(g_perf_freq.QuadPart));
+		limiter_sleep(deadline);
+	}
+	return !g_aborted;
+}
+
+static bool write_paced(output_t *const output, const HANDLE handle, const bool is_pipe, const BYTE *const data, const DWORD data_len, const DWORD align)
+{
+	for(DWORD offset = 0U, piece; offset < data_len; offset += piece)
+	{
+		const LONG64 rate = limiter_rate();
+		piece = rate ? min(data_len - offset, limiter_quantum(rate, align)) : (data_len - offset);
+		if(!(limiter_pace(output, piece) && write_chunk(handle, is_pipe, data + offset, piece, output->trace)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool limiter_open(void)
+{
+	wsprintfW(g_limiter.pipe_name, L"\\\\.\\pipe\\pv-%lu", GetCurrentProcessId());
+	if(g_limiter.timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS))
+	{
+		g_limiter.high_resolution = true;
+	}
+	else if(!(g_limiter.timer = CreateWaitableTimerW(NULL, FALSE, NULL)))
+	{
+		return false;
+	}
+	if((g_limiter.pipe = CreateNamedPipeW(g_limiter.pipe_name, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1U, 0U, 256U, 0U, NULL)) == INVALID_HANDLE_VALUE)
+	{
+		g_limiter.pipe = NULL;
+		return false;
+	}
+	return true;
+}
+
+static void limiter_close(void)
+{
+	if(g_limiter.pipe)
+	{
+		CloseHandle(g_limiter.pipe);
+	}
+	if(g_limiter.timer)
+	{
+		CloseHandle(g_limiter.timer);
+	}
+}
+
+static bool control_wait(OVERLAPPED *const request, const HANDLE done, DWORD &bytes_done)
+{
+	const HANDLE wait_handles[] = { request->hEvent, done };
+	if(WaitForMultipleObjects(2U, wait_handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+	{
+		CancelIo(g_limiter.pipe);
+		GetOverlappedResult(g_limiter.pipe, request, &bytes_done, TRUE);
+		return false;
+	}
+	return GetOverlappedResult(g_limiter.pipe, request, &bytes_done, FALSE) ? true : false;
+}
+
+static void control_apply(const CHAR *const command)
+{
+	WCHAR text[64U];
+	DWORD len = 0U;
+	for(; command[len] && (len < ARRAYSIZE(text) - 1U); ++len)
+	{
+		text[len] = (WCHAR)(BYTE)command[len];
+	}
+	text[len] = L'\0';
+	if((lstrcmpiW(text, L"off") == 0) || (lstrcmpiW(text, L"0") == 0))
+	{
+		InterlockedExchange64(&g_limiter.rate, 0LL);
+	}
+	else if(const ULONG64 value = parse_number(text))
+	{
+		InterlockedExchange64(&g_limiter.rate, (LONG64) min(value, MAXLONGLONG));
+	}
+}
+
+static DWORD __stdcall control_thread(const LPVOID param)
+{
+	const HANDLE done = (HANDLE)param;
+	OVERLAPPED request;
+	CHAR command[64U];
+	DWORD bytes_done;
+
+	SecureZeroMemory(&request, sizeof(OVERLAPPED));
+	if(!(request.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)))
+	{
+		return 1U;
+	}
+
+	for(;;)
+	{
+		DWORD len = 0U;
+		ResetEvent(request.hEvent);
+		if(!ConnectNamedPipe(g_limiter.pipe, &request))
+		{
+			const DWORD error = GetLastError();
+			if((error == ERROR_IO_PENDING) && (!control_wait(&request, done, bytes_done)))
+			{
+				break; /*stop*/
+			}
+			else if((error != ERROR_IO_PENDING) && (error != ERROR_PIPE_CONNECTED))
+			{
+				break;
+			}
+		}
+		while(len < sizeof(command) - 1U)
+		{
+			ResetEvent(request.hEvent);
+			if((!ReadFile(g_limiter.pipe, command + len, sizeof(command) - 1U - len, NULL, &request)) && (GetLastError() != ERROR_IO_PENDING))
+			{
+				break; /*client has closed the pipe*/
+			}
+			if(!control_wait(&request, done, bytes_done))
+			{
+				if(WaitForSingleObject(done, 0U) == WAIT_OBJECT_0)
+				{
+					goto stop;
+				}
+				break;
+			}
+			len += bytes_done;
+		}
+		command[len] = '\0';
+		for(DWORD pos = 0U; pos < len; ++pos)
+		{
+			if((command[pos] == '\r') || (command[pos] == '\n'))
+			{
+				command[pos] = '\0';
+				break;
+			}
+		}
+		control_apply(command);
+		DisconnectNamedPipe(g_limiter.pipe);
+	}
+
+stop:
+	CloseHandle(request.hEvent);
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Sparse output                                                           */
+/* ======================================================================= */
+
+#define SPARSE_BLOCK 65536U /*NTFS allocates sparse files in units of 64 KiB*/
+
+typedef struct sparse_t
+{
+	LONG64 offset;       /*current file pointer*/
+	LONG64 hole;         /*zero bytes skipped but not yet seeked over*/
+	LONG64 initial_size; /*holes below this size must be punched*/
+	LONG64 zero_bytes, regions;
+}
+sparse_t;
+
+static sparse_t g_sparse[MAX_OUTPUTS];
+
+static bool zero_scalar(const BYTE *data, DWORD len)
+{
+	for(; len >= sizeof(ULONG_PTR); len -= sizeof(ULONG_PTR), data += sizeof(ULONG_PTR))
+	{
+		if(*((const ULONG_PTR*)data))
+		{
+			return false;
+		}
+	}
+	while(len--)
+	{
+		if(*data++)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool zero_sse2(const BYTE *data, DWORD len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for(; len >= 64U; len -= 64U, data += 64U)
+	{
+		const __m128i acc = _mm_or_si128(_mm_or_si128(_mm_loadu_si128((const __m128i*)data), _mm_loadu_si128((const __m128i*)(data + 16U))),
+			_mm_or_si128(_mm_loadu_si128((const __m128i*)(data + 32U)), _mm_loadu_si128((const __m128i*)(data + 48U))));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF)
+		{
+			return false;
+		}
+	}
+	return zero_scalar(data, len);
+}
+
+#ifdef HAVE_AVX2
+static bool zero_avx2(const BYTE *data, DWORD len)
+{
+	bool result = true;
+	for(; len >= 128U; len -= 128U, data += 128U)
+	{
+		const __m256i acc = _mm256_or_si256(_mm256_or_si256(_mm256_loadu_si256((const __m256i*)data), _mm256_loadu_si256((const __m256i*)(data + 32U))),
+			_mm256_or_si256(_mm256_loadu_si256((const __m256i*)(data + 64U)), _mm256_loadu_si256((const __m256i*)(data + 96U))));
+		if(!_mm256_testz_si256(acc, acc))
+		{
+			result = false;
+			break;
+		}
+	}
+	_mm256_zeroupper();
+	return result && zero_sse2(data, len);
+}
+#endif
+
+static __inline bool is_zero(const BYTE *const data, const DWORD len)
+{
+#ifdef HAVE_AVX2
+	if(g_cpu_features & CPU_AVX2)
+	{
+		return zero_avx2(data, len);
+	}
+#endif
+	return (g_cpu_features & CPU_SSE2) ? zero_sse2(data, len) : zero_scalar(data, len);
+}
+
+static sparse_t *sparse_open(output_t *const output, const HANDLE std_err)
+{
+	sparse_t *const sparse = &g_sparse[output - g_outputs];
+	LARGE_INTEGER file_pos, file_size, zero;
+	DWORD bytes_returned;
+	zero.QuadPart = 0LL;
+	if((GetFileType(output->handle) != FILE_TYPE_DISK) || (!SetFilePointerEx(output->handle, zero, &file_pos, FILE_CURRENT)) || (!GetFileSizeEx(output->handle, &file_size)))
+	{
+		return NULL; /*pipe, character device or volume*/
+	}
+	if(!DeviceIoControl(output->handle, FSCTL_SET_SPARSE, NULL, 0U, NULL, 0U, &bytes_returned, NULL))
+	{
+		print_text_fmt(std_err, "Warning: Output \"%S\" does not support sparse files -> writing all data!\n", output->name);
+		return NULL;
+	}
+	SecureZeroMemory(sparse, sizeof(sparse_t));
+	sparse->offset = file_pos.QuadPart;
+	sparse->initial_size = file_size.QuadPart;
+	return sparse;
+}
+
+static bool sparse_skip(output_t *const output)
+{
+	sparse_t *const sparse = output->sparse;
+	if(sparse->hole > 0LL)
+	{
+		FILE_ZERO_DATA_INFORMATION zero_data;
+		LARGE_INTEGER distance;
+		DWORD bytes_returned;
+		if(sparse->offset < sparse->initial_size)
+		{
+			zero_data.FileOffset.QuadPart = sparse->offset;
+			zero_data.BeyondFinalZero.QuadPart = min(sparse->offset + sparse->hole, sparse->initial_size);
+			if(!DeviceIoControl(output->handle, FSCTL_SET_ZERO_DATA, &zero_data, sizeof(FILE_ZERO_DATA_INFORMATION), NULL, 0U, &bytes_returned, NULL))
+			{
+				return false; /*punch a hole into the pre-existing data*/
+			}
+		}
+		distance.QuadPart = sparse->hole;
+		if(!SetFilePointerEx(output->handle, distance, NULL, FILE_CURRENT))
+		{
+			return false;
+		}
+		sparse->offset += sparse->hole;
+		sparse->hole = 0LL;
+	}
+	return true;
+}
+
+static bool sparse_write(output_t *const output, const bool is_pipe, const BYTE *const data, const DWORD data_len)
+{
+	sparse_t *const sparse = output->sparse;
+	DWORD start = 0U;
+	for(DWORD offset = 0U, block; offset < data_len; offset += block)
+	{
+		const LONG64 position = sparse->offset + sparse->hole + (offset - start);
+		block = min(SPARSE_BLOCK - (DWORD)(position % SPARSE_BLOCK), data_len - offset);
+		if((block < SPARSE_BLOCK) || (!is_zero(data + offset, block)))
+		{
+			continue; /*only whole, aligned blocks can become holes*/
+		}
+		if(offset > start)
+		{
+			if(!(sparse_skip(output) && write_paced(output, output->handle, is_pipe, data + start, offset - start, 1U)))
+			{
+				return false;
+			}
+			sparse->offset += offset - start;
+		}
+		sparse->regions += sparse->hole ? 0LL : 1LL;
+		sparse->hole += block;
+		sparse->zero_bytes += block;
+		start = offset + block;
+	}
+	if(start < data_len)
+	{
+		if(!(sparse_skip(output) && write_paced(output, output->handle, is_pipe, data + start, data_len - start, 1U)))
+		{
+			return false;
+		}
+		sparse->offset += data_len - start;
+	}
+	return true;
+}
+
+static bool sparse_close(output_t *const output)
+{
+	LARGE_INTEGER file_size;
+	if((!output->sparse) || (output->sparse->hole < 1LL))
+	{
+		return true;
+	}
+	if(!sparse_skip(output))
+	{
+		return false;
+	}
+	return (GetFileSizeEx(output->handle, &file_size) && (file_size.QuadPart >= output->sparse->offset)) || SetEndOfFile(output->handle); /*a trailing hole must still count towards the file size*/
+}
+
+/* ======================================================================= */
+/* Write thread                                                            */
+/* ======================================================================= */
+
+static __inline void output_count(output_t *const output, const DWORD bytes)
+{
+	output->bytes_written += bytes;
+	if(output == g_outputs)
+	{
+		InterlockedExchangeAdd64(&g_bytes_transferred, bytes); /*throughput is measured on the primary output*/
+	}
+}
+
+static LONG collect_span(const LONG slot_index, const LONG slots_avail, const DWORD max_span, DWORD &span_len)
+{
+	LONG span_count = 1L;
+	span_len = g_slots[slot_index].len;
+	if(!g_slots[slot_index].view)
+	{
+		for(LONG next = (slot_index + 1U) % g_slot_count; (span_count < slots_avail) && (!g_slots[next].view) && (span_len + g_slots[next].len <= max_span); next = (next + 1U) % g_slot_count)
+		{
+			span_len += g_slots[next].len; /*ring-resident chunks are contiguous in the double-mapped ring*/
+			++span_count;
+		}
+	}
+	return span_count;
+}
+
+static DWORD write_async(output_t *const output, async_io_t *const io, const DWORD max_span)
+{
+	LONG slot_index = 0U, submitted = 0L;
+	ring_cursor_t *const cursor = &output->cursor;
+
+	while(output->active)
+	{
+		while((io->pending < io->depth) && (ring_used(cursor) > submitted) && ring_flowing(cursor))
+		{
+			DWORD span_len;
+			const bool is_view = (g_slots[slot_index].view != NULL);
+			const LONG span_count = collect_span(slot_index, ring_used(cursor) - submitted, max_span, span_len);
+			handoff_record(output, slot_index);
+			if(!async_submit(io, true, g_slots[slot_index].ptr, span_len, span_count, is_view ? 0U : span_len))
+			{
+				goto failure;
+			}
+			slot_index = (slot_index + span_count) % g_slot_count;
+			submitted += span_count;
+		}
+
+		if(io->pending < 1U)
+		{
+			if(!ring_wait(cursor, false, 0U))
+			{
+				break;
+			}
+			continue;
+		}
+
+		DWORD index, bytes_written = 0U;
+		if((!async_complete(io, false, index, bytes_written)) || (bytes_written != io->length[index]))
+		{
+			goto failure;
+		}
+
+		output_count(output, bytes_written);
+
+		submitted -= io->count[index];
+		output_release(output, io->count[index], io->ring_bytes[index]);
+	}
+
+	async_close(io, output->handle);
+	return 0U;
+
+failure:
+	async_close(io, output->handle);
+	output_failed(output);
+	return 0U;
+}
+
+static void preallocate(const HANDLE handle)
+{
+	FILE_ALLOCATION_INFO allocation_info;
+	LARGE_INTEGER file_pos, zero;
+	zero.QuadPart = 0LL;
+	if((g_input_size > 0LL) && (GetFileType(handle) == FILE_TYPE_DISK) && SetFilePointerEx(handle, zero, &file_pos, FILE_CURRENT))
+	{
+		allocation_info.AllocationSize.QuadPart = file_pos.QuadPart + g_input_size;
+		SetFileInformationByHandle(handle, FileAllocationInfo, &allocation_info, sizeof(FILE_ALLOCATION_INFO));
+	}
+}
+
+static bool direct_open(HANDLE &direct, const HANDLE original, LONG64 &offset)
+{
+	LARGE_INTEGER file_pos, zero;
+	zero.QuadPart = 0LL;
+	if((!g_options.direct_io) || (GetFileType(original) != FILE_TYPE_DISK) || (!SetFilePointerEx(original, zero, &file_pos, FILE_CURRENT)) || (file_pos.QuadPart % DIRECT_ALIGN))
+	{
+		return false;
+	}
+	if((direct = ReOpenFile(original, GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_NO_BUFFERING)) == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+	if(!SetFilePointerEx(direct, file_pos, NULL, FILE_BEGIN))
+	{
+		CloseHandle(direct);
+		return false;
+	}
+	offset = file_pos.QuadPart;
+	return true;
+}
+
+static LONG release_slots(LONG &slot_index, DWORD &partial, DWORD length)
+{
+	LONG count = 0L;
+	while(length > 0U)
+	{
+		const DWORD remaining = g_slots[slot_index].len - partial;
+		if(length < remaining)
+		{
+			partial += length;
+			break;
+		}
+		length -= remaining;
+		partial = 0U;
+		INCREMENT(slot_index);
+		++count;
+	}
+	return count;
+}
+
+static bool write_bounce(output_t *const output, const HANDLE direct, BYTE *const bounce, DWORD &carry, LONG64 &offset, const BYTE *const data, const DWORD length)
+{
+	LARGE_INTEGER file_pos;
+	CopyMemory(bounce + carry, data, length);
+	carry += length;
+	file_pos.QuadPart = offset;
+	if(!(SetFilePointerEx(direct, file_pos, NULL, FILE_BEGIN) && limiter_pace(output, length) && write_chunk(direct, false, bounce, DIRECT_ALIGN, output->trace)))
+	{
+		return false;
+	}
+	if(carry >= DIRECT_ALIGN)
+	{
+		offset += DIRECT_ALIGN; /*the block is complete, otherwise it gets rewritten with the next bytes*/
+		carry = 0U;
+	}
+	return true;
+}
+
+static DWORD write_direct(output_t *const output, const HANDLE direct, LONG64 offset, const DWORD max_span)
+{
+	LONG slot_index = 0U;
+	DWORD partial = 0U, carry = 0U;
+	ULONG_PTR ring_offset = 0U;
+	LARGE_INTEGER file_pos;
+	ring_cursor_t *const cursor = &output->cursor;
+	const DWORD max_len = max(max_span & (~(DIRECT_ALIGN - 1U)), DIRECT_ALIGN);
+	BYTE *const bounce = (BYTE*) VirtualAlloc(NULL, DIRECT_ALIGN, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	bool success = (bounce != NULL);
+
+	while(success && output->active && ring_wait(cursor, false, DIRECT_ALIGN))
+	{
+		const ULONG_PTR available = ring_bytes(cursor);
+		DWORD length;
+		if(carry || (available < DIRECT_ALIGN))
+		{
+			length = (DWORD) min(available, DIRECT_ALIGN - carry); /*the reader is out of slots, flush a padded block*/
+			success = write_bounce(output, direct, bounce, carry, offset, g_ring_base + ring_offset, length);
+		}
+		else
+		{
+			length = (DWORD) min(available, max_len) & (~(DIRECT_ALIGN - 1U));
+			success = write_paced(output, direct, false, g_ring_base + ring_offset, length, DIRECT_ALIGN);
+			offset += length;
+		}
+		if(!success)
+		{
+			break;
+		}
+		output_count(output, length);
+		ring_offset = (ring_offset + length) % g_options.ring_size;
+		output_release(output, release_slots(slot_index, partial, length), length);
+	}
+
+	if(success && output->active)
+	{
+		for(ULONG_PTR available; success && ((available = ring_bytes(cursor)) > 0U); )
+		{
+			const DWORD length = (DWORD) min(available, DIRECT_ALIGN - carry);
+			if(success = write_bounce(output, direct, bounce, carry, offset, g_ring_base + ring_offset, length))
+			{
+				output_count(output, length);
+				ring_offset = (ring_offset + length) % g_options.ring_size;
+				output_release(output, release_slots(slot_index, partial, length), length);
+			}
+		}
+		if(success && carry)
+		{
+			FILE_END_OF_FILE_INFO end_of_file;
+			end_of_file.EndOfFile.QuadPart = offset + carry;
+			if(success = (SetFileInformationByHandle(direct, FileEndOfFileInfo, &end_of_file, sizeof(FILE_END_OF_FILE_INFO)) != FALSE))
+			{
+				offset += carry;
+			}
+		}
+	}
+
+	if(bounce)
+	{
+		VirtualFree(bounce, 0U, MEM_RELEASE);
+	}
+
+	CloseHandle(direct);
+	file_pos.QuadPart = offset;
+	SetFilePointerEx(output->handle, file_pos, NULL, FILE_BEGIN);
+
+	if(!success)
+	{
+		output_failed(output);
+	}
+	return 0U;
+}
+
+static DWORD __stdcall write_thread(const LPVOID param)
+{
+	LONG slot_index = 0U;
+	async_io_t async_io;
+	output_t *const output = (output_t*)param;
+	ring_cursor_t *const cursor = &output->cursor;
+	const bool is_pipe = (GetFileType(output->handle) == FILE_TYPE_PIPE);
+	const DWORD max_span = (DWORD) min(g_options.ring_size / 4U, MAXLONG);
+
+	LONG64 direct_offset;
+	HANDLE direct;
+
+	if(!output->sparse)
+	{
+		preallocate(output->handle);
+
+		if(direct_open(direct, output->handle, direct_offset))
+		{
+			return write_direct(output, direct, direct_offset, max_span);
+		}
+
+		if((!g_options.rate_limit) && async_open(&async_io, output->handle, GENERIC_WRITE, false))
+		{
+			async_io.trace = output->trace;
+			return write_async(output, &async_io, max_span);
+		}
+	}
+
+	while(output->active)
+	{
+		if(!ring_wait(cursor, false, 0U))
+		{
+			break;
+		}
+
+		DWORD span_len;
+		const bool is_view = (g_slots[slot_index].view != NULL);
+		const LONG span_count = collect_span(slot_index, ring_used(cursor), max_span, span_len);
+		handoff_record(output, slot_index);
+
+		if(!(output->sparse ? sparse_write(output, is_pipe, g_slots[slot_index].ptr, span_len) : write_paced(output, output->handle, is_pipe, g_slots[slot_index].ptr, span_len, 1U)))
+		{
+			output_failed(output);
+			return 0U;
+		}
+
+		output_count(output, span_len);
+
+		slot_index = (slot_index + span_count) % g_slot_count;
+		output_release(output, span_count, is_view ? 0U : span_len);
+	}
+
+	if(!sparse_close(output))
+	{
+		output_failed(output);
+	}
+
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Digests                                                                 */
+/* ======================================================================= */
+
+#define DIGEST_CRC32C 0x1U
+#define DIGEST_XXH64  0x2U
+#define DIGEST_SHA256 0x4U
+#define DIGEST_COUNT 3U
+
+#define CRC32C_POLY 0x82F63B78U
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+typedef struct xxh64_state_t
+{
+	ULONG64 v[4U];
+	ULONG64 total_len;
+	BYTE buffer[32U];
+	DWORD buffer_len;
+}
+xxh64_state_t;
+
+typedef struct sha256_state_t
+{
+	DWORD h[8U];
+	ULONG64 total_len;
+	BYTE buffer[64U];
+	DWORD buffer_len;
+}
+sha256_state_t;
+
+typedef struct digest_t
+{
+	DWORD algorithm;
+	union
+	{
+		DWORD crc;
+		xxh64_state_t xxh;
+		sha256_state_t sha;
+	}
+	state;
+	BYTE result[32U];
+	DWORD result_len;
+}
+digest_t;
+
+static DWORD g_crc32c_table[256U];
+static digest_t g_digests[DIGEST_COUNT];
+
+static const DWORD SHA256_K[64U] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const char *const DIGEST_NAMES[DIGEST_COUNT] = { "CRC32C", "XXH64", "SHA256" };
+
+/* CRC32C (Castagnoli), using the SSE4.2 instruction when available */
+
+static void crc32c_init_table(void)
+{
+	for(DWORD i = 0U; i < 256U; ++i)
+	{
+		DWORD crc = i;
+		for(DWORD j = 0U; j < 8U; ++j)
+		{
+			crc = (crc & 1U) ? ((crc >> 1) ^ CRC32C_POLY) : (crc >> 1);
+		}
+		g_crc32c_table[i] = crc;
+	}
+}
+
+static DWORD crc32c_update_sw(DWORD crc, const BYTE *data, SIZE_T len)
+{
+	while(len--)
+	{
+		crc = g_crc32c_table[(crc ^ (*data++)) & 0xFF] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+static DWORD crc32c_update_hw(DWORD crc, const BYTE *data, SIZE_T len)
+{
+#if defined(_M_X64)
+	ULONG64 crc64 = crc;
+	for(; len >= sizeof(ULONG64); len -= sizeof(ULONG64), data += sizeof(ULONG64))
+	{
+		crc64 = _mm_crc32_u64(crc64, *((const ULONG64*)data));
+	}
+	crc = (DWORD)crc64;
+#else
+	for(; len >= sizeof(DWORD); len -= sizeof(DWORD), data += sizeof(DWORD))
+	{
+		crc = _mm_crc32_u32(crc, *((const DWORD*)data));
+	}
+#endif
+	while(len--)
+	{
+		crc = _mm_crc32_u8(crc, *data++);
+	}
+	return crc;
+}
+
+/* XXH64 */
+
+static __forceinline ULONG64 xxh64_round(ULONG64 acc, const ULONG64 input)
+{
+	acc += input * XXH_PRIME64_2;
+	return _rotl64(acc, 31) * XXH_PRIME64_1;
+}
+
+static __forceinline ULONG64 xxh64_merge(ULONG64 acc, const ULONG64 value)
+{
+	acc ^= xxh64_round(0U, value);
+	return (acc * XXH_PRIME64_1) + XXH_PRIME64_4;
+}
+
+static __forceinline ULONG64 read64(const BYTE *const data)
+{
+	return *((const ULONG64*)data); /*little-endian, unaligned access is fine on x86*/
+}
+
+static __forceinline DWORD read32(const BYTE *const data)
+{
+	return *((const DWORD*)data);
+}
+
+static void xxh64_init(xxh64_state_t *const state)
+{
+	SecureZeroMemory(state, sizeof(xxh64_state_t));
+	state->v[0U] = XXH_PRIME64_1 + XXH_PRIME64_2;
+	state->v[1U] = XXH_PRIME64_2;
+	state->v[2U] = 0U;
+	state->v[3U] = 0U - XXH_PRIME64_1;
+}
+
+static void xxh64_update(xxh64_state_t *const state, const BYTE *data, SIZE_T len)
+{
+	state->total_len += len;
+	if(state->buffer_len > 0U)
+	{
+		const DWORD fill = (DWORD) min(len, 32U - state->buffer_len);
+		CopyMemory(state->buffer + state->buffer_len, data, fill);
+		state->buffer_len += fill;
+		data += fill;
+		len -= fill;
+		if(state->buffer_len < 32U)
+		{
+			return;
+		}
+		for(DWORD i = 0U; i < 4U; ++i)
+		{
+			state->v[i] = xxh64_round(state->v[i], read64(state->buffer + (8U * i)));
+		}
+		state->buffer_len = 0U;
+	}
+	ULONG64 v1 = state->v[0U], v2 = state->v[1U], v3 = state->v[2U], v4 = state->v[3U];
+	for(; len >= 32U; len -= 32U, data += 32U)
+	{
+		v1 = xxh64_round(v1, read64(data));
+		v2 = xxh64_round(v2, read64(data + 8U));
+		v3 = xxh64_round(v3, read64(data + 16U));
+		v4 = xxh64_round(v4, read64(data + 24U));
+	}
+	state->v[0U] = v1; state->v[1U] = v2; state->v[2U] = v3; state->v[3U] = v4;
+	if(len > 0U)
+	{
+		CopyMemory(state->buffer, data, len);
+		state->buffer_len = (DWORD)len;
+	}
+}
+
+static ULONG64 xxh64_final(const xxh64_state_t *const state)
+{
+	ULONG64 hash;
+	const BYTE *data = state->buffer;
+	DWORD len = state->buffer_len;
+	if(state->total_len >= 32U)
+	{
+		hash = _rotl64(state->v[0U], 1) + _rotl64(state->v[1U], 7) + _rotl64(state->v[2U], 12) + _rotl64(state->v[3U], 18);
+		for(DWORD i = 0U; i < 4U; ++i)
+		{
+			hash = xxh64_merge(hash, state->v[i]);
+		}
+	}
+	else
+	{
+		hash = state->v[2U] + XXH_PRIME64_5;
+	}
+	hash += state->total_len;
+	for(; len >= 8U; len -= 8U, data += 8U)
+	{
+		hash ^= xxh64_round(0U, read64(data));
+		hash = (_rotl64(hash, 27) * XXH_PRIME64_1) + XXH_PRIME64_4;
+	}
+	if(len >= 4U)
+	{
+		hash ^= ((ULONG64)read32(data)) * XXH_PRIME64_1;
+		hash = (_rotl64(hash, 23) * XXH_PRIME64_2) + XXH_PRIME64_3;
+		len -= 4U;
+		data += 4U;
+	}
+	while(len--)
+	{
+		hash ^= (*data++) * XXH_PRIME64_5;
+		hash = _rotl64(hash, 11) * XXH_PRIME64_1;
+	}
+	hash ^= hash >> 33;
+	hash *= XXH_PRIME64_2;
+	hash ^= hash >> 29;
+	hash *= XXH_PRIME64_3;
+	return hash ^ (hash >> 32);
+}
+
+/* SHA-256 */
+
+#define SHA256_S0(X) (_rotr((X), 2) ^ _rotr((X), 13) ^ _rotr((X), 22))
+#define SHA256_S1(X) (_rotr((X), 6) ^ _rotr((X), 11) ^ _rotr((X), 25))
+#define SHA256_G0(X) (_rotr((X), 7) ^ _rotr((X), 18) ^ ((X) >> 3))
+#define SHA256_G1(X) (_rotr((X), 17) ^ _rotr((X), 19) ^ ((X) >> 10))
+
+static void sha256_init(sha256_state_t *const state)
+{
+	static const DWORD SHA256_H0[8U] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	SecureZeroMemory(state, sizeof(sha256_state_t));
+	CopyMemory(state->h, SHA256_H0, sizeof(SHA256_H0));
+}
+
+static void sha256_block(DWORD *const h, const BYTE *const block)
+{
+	DWORD w[64U], a = h[0U], b = h[1U], c = h[2U], d = h[3U], e = h[4U], f = h[5U], g = h[6U], k = h[7U];
+	for(DWORD i = 0U; i < 16U; ++i)
+	{
+		w[i] = _byteswap_ulong(read32(block + (4U * i)));
+	}
+	for(DWORD i = 16U; i < 64U; ++i)
+	{
+		w[i] = SHA256_G1(w[i - 2U]) + w[i - 7U] + SHA256_G0(w[i - 15U]) + w[i - 16U];
+	}
+	for(DWORD i = 0U; i < 64U; ++i)
+	{
+		const DWORD t1 = k + SHA256_S1(e) + ((e & f) ^ ((~e) & g)) + SHA256_K[i] + w[i];
+		const DWORD t2 = SHA256_S0(a) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0U] += a; h[1U] += b; h[2U] += c; h[3U] += d;
+	h[4U] += e; h[5U] += f; h[6U] += g; h[7U] += k;
+}
+
+static void sha256_update(sha256_state_t *const state, const BYTE *data, SIZE_T len)
+{
+	state->total_len += len;
+	if(state->buffer_len > 0U)
+	{
+		const DWORD fill = (DWORD) min(len, 64U - state->buffer_len);
+		CopyMemory(state->buffer + state->buffer_len, data, fill);
+		state->buffer_len += fill;
+		data += fill;
+		len -= fill;
+		if(state->buffer_len < 64U)
+		{
+			return;
+		}
+		sha256_block(state->h, state->buffer);
+		state->buffer_len = 0U;
+	}
+	for(; len >= 64U; len -= 64U, data += 64U)
+	{
+		sha256_block(state->h, data);
+	}
+	if(len > 0U)
+	{
+		CopyMemory(state->buffer, data, len);
+		state->buffer_len = (DWORD)len;
+	}
+}
+
+static void sha256_final(sha256_state_t *const state, BYTE *const result)
+{
+	const ULONG64 total_bits = state->total_len * 8U;
+	BYTE padding[72U];
+	const DWORD pad_len = ((state->buffer_len < 56U) ? 56U : 120U) - state->buffer_len;
+	SecureZeroMemory(padding, sizeof(padding));
+	padding[0U] = 0x80;
+	for(DWORD i = 0U; i < 8U; ++i)
+	{
+		padding[pad_len + i] = (BYTE)(total_bits >> (56U - (8U * i)));
+	}
+	sha256_update(state, padding, pad_len + 8U);
+	for(DWORD i = 0U; i < 8U; ++i)
+	{
+		const DWORD value = _byteswap_ulong(state->h[i]);
+		CopyMemory(result + (4U * i), &value, sizeof(DWORD));
+	}
+}
+
+/* Generic interface */
+
+static void digest_init(digest_t *const digest, const DWORD algorithm)
+{
+	SecureZeroMemory(digest, sizeof(digest_t));
+	switch(digest->algorithm = algorithm)
+	{
+	case DIGEST_CRC32C:
+		crc32c_init_table();
+		digest->state.crc = MAXDWORD;
+		break;
+	case DIGEST_XXH64:
+		xxh64_init(&digest->state.xxh);
+		break;
+	case DIGEST_SHA256:
+		sha256_init(&digest->state.sha);
+		break;
+	}
+}
+
+static void digest_update(digest_t *const digest, const BYTE *const data, const SIZE_T len)
+{
+	switch(digest->algorithm)
+	{
+	case DIGEST_CRC32C:
+		digest->state.crc = (g_cpu_features & CPU_SSE42) ? crc32c_update_hw(digest->state.crc, data, len) : crc32c_update_sw(digest->state.crc, data, len);
+		break;
+	case DIGEST_XXH64:
+		xxh64_update(&digest->state.xxh, data, len);
+		break;
+	case DIGEST_SHA256:
+		sha256_update(&digest->state.sha, data, len);
+		break;
+	}
+}
+
+static void digest_final(digest_t *const digest)
+{
+	switch(digest->algorithm)
+	{
+	case DIGEST_CRC32C:
+		{
+			const DWORD value = _byteswap_ulong(~digest->state.crc);
+			CopyMemory(digest->result, &value, digest->result_len = sizeof(DWORD));
+		}
+		break;
+	case DIGEST_XXH64:
+		{
+			const ULONG64 value = _byteswap_uint64(xxh64_final(&digest->state.xxh));
+			CopyMemory(digest->result, &value, digest->result_len = sizeof(ULONG64));
+		}
+		break;
+	case DIGEST_SHA256:
+		sha256_final(&digest->state.sha, digest->result);
+		digest->result_len = 32U;
+		break;
+	}
+}
+
+static const char *digest_name(const DWORD algorithm)
+{
+	DWORD index;
+	_BitScanForward(&index, algorithm);
+	return DIGEST_NAMES[index];
+}
+
+static void print_digests(const HANDLE output)
+{
+	static const char *const HEX_CHARS = "0123456789abcdef";
+	char hex[65U];
+	for(DWORD index = 0U; index < g_output_count; ++index)
+	{
+		if(digest_t *const digest = g_outputs[index].digest)
+		{
+			for(DWORD i = 0U; i < digest->result_len; ++i)
+			{
+				hex[2U * i] = HEX_CHARS[digest->result[i] >> 4];
+				hex[(2U * i) + 1U] = HEX_CHARS[digest->result[i] & 0xF];
+			}
+			hex[2U * digest->result_len] = '\0';
+			print_text_fmt(output, "%s (-) = %s\n", digest_name(digest->algorithm), hex);
+		}
+	}
+}
+
+static DWORD __stdcall digest_thread(const LPVOID param)
+{
+	LONG slot_index = 0U;
+	output_t *const output = (output_t*)param;
+	ring_cursor_t *const cursor = &output->cursor;
+	const DWORD max_span = (DWORD) min(g_options.ring_size / 4U, MAXLONG);
+
+	while(ring_wait(cursor, false, 0U))
+	{
+		DWORD span_len;
+		const bool is_view = (g_slots[slot_index].view != NULL);
+		const LONG span_count = collect_span(slot_index, ring_used(cursor), max_span, span_len);
+		digest_update(output->digest, g_slots[slot_index].ptr, span_len);
+		slot_index = (slot_index + span_count) % g_slot_count;
+		output_release(output, span_count, is_view ? 0U : span_len);
+	}
+
+	digest_final(output->digest);
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Content statistics                                                      */
+/* ======================================================================= */
+
+typedef struct __declspec(align(CACHE_LINE)) content_t
+{
+	volatile LONG64 count[256U];
+}
+content_t;
+
+static content_t g_content;
+
+#define ENTROPY_DENSE 7900U /*millibits per byte*/
+
+static void content_update(content_t *const content, const BYTE *data, SIZE_T len)
+{
+	DWORD table[4U][256U]; /*separate tables break the dependency chain on runs of equal bytes*/
+	SecureZeroMemory(table, sizeof(table));
+	for(; len >= sizeof(ULONG64); len -= sizeof(ULONG64), data += sizeof(ULONG64))
+	{
+		const ULONG64 value = *((const ULONG64*)data);
+		const DWORD lo = (DWORD)value, hi = (DWORD)(value >> 32);
+		++table[0U][lo & 0xFF];
+		++table[1U][(lo >> 8) & 0xFF];
+		++table[2U][(lo >> 16) & 0xFF];
+		++table[3U][lo >> 24];
+		++table[0U][hi & 0xFF];
+		++table[1U][(hi >> 8) & 0xFF];
+		++table[2U][(hi >> 16) & 0xFF];
+		++table[3U][hi >> 24];
+	}
+	while(len--)
+	{
+		++table[0U][*data++];
+	}
+	for(DWORD i = 0U; i < 256U; ++i)
+	{
+		if(const DWORD count = table[0U][i] + table[1U][i] + table[2U][i] + table[3U][i])
+		{
+			InterlockedExchangeAdd64(&content->count[i], count);
+		}
+	}
+}
+
+static void content_snapshot(content_t *const content, LONG64 *const counts)
+{
+	for(DWORD i = 0U; i < 256U; ++i)
+	{
+		counts[i] = InterlockedExchangeAdd64(&content->count[i], 0LL);
+	}
+}
+
+static DWORD content_entropy(const LONG64 *const counts, const LONG64 *const base)
+{
+	double total = 0.0, sum = 0.0;
+	for(DWORD i = 0U; i < 256U; ++i)
+	{
+		const LONG64 count = counts[i] - (base ? base[i] : 0LL);
+		if(count > 0LL)
+		{
+			const double value = static_cast<double>(count);
+			total += value;
+			sum += value * log2_approx(value);
+		}
+	}
+	return (total > 0.0) ? bound(0U, (DWORD) max(0L, round((log2_approx(total) - (sum / total)) * 1000.0)), 8000U) : MAXDWORD; /*millibits per byte*/
+}
+
+static DWORD __stdcall content_thread(const LPVOID param)
+{
+	LONG slot_index = 0U;
+	output_t *const output = (output_t*)param;
+	ring_cursor_t *const cursor = &output->cursor;
+	const DWORD max_span = (DWORD) min(g_options.ring_size / 4U, MAXLONG);
+
+	while(ring_wait(cursor, false, 0U))
+	{
+		DWORD span_len;
+		const bool is_view = (g_slots[slot_index].view != NULL);
+		const LONG span_count = collect_span(slot_index, ring_used(cursor), max_span, span_len);
+		content_update(output->content, g_slots[slot_index].ptr, span_len);
+		slot_index = (slot_index + span_count) % g_slot_count;
+		output_release(output, span_count, is_view ? 0U : span_len);
+	}
+
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Status update                                                           */
+/* ======================================================================= */
+
+#define STATS_JSON 0U
+#define STATS_CSV  1U
+#define ETA_WINDOW 32U
+
+typedef struct status_t
+{
+	HANDLE std_err, stats_file;
+	HANDLE timer, done;
+	LONG64 time_start, time_ref;
+	LONG64 bytes_total, bytes_current;
+	double current_rate, average_rate;
+	LONG64 stall_read, stall_write;
+	DWORD stall_read_current, stall_write_current, fill;
+	ULONG64 fill_sum;
+	DWORD fill_samples;
+	double window_time[ETA_WINDOW], window_bytes[ETA_WINDOW];
+	DWORD window_count, window_next;
+	DWORD progress;
+	LONG64 eta;
+	LONG64 records_total;
+	double record_rate;
+	LONG64 content_base[256U];
+	DWORD entropy;
+}
+status_t;
+
+static __inline DWORD permille(const LONG64 part, const LONG64 total)
+{
+	return (total > 0LL) ? ((DWORD) min(round64((static_cast<double>(part) / static_cast<double>(total)) * 1000.0), 1000LL)) : 0U;
+}
+
+static DWORD ring_fill(void)
+{
+	const DWORD fill_bytes = permille((LONG64)ring_bytes(), (LONG64)g_options.ring_size);
+	const DWORD fill_slots = permille(ring_used(), g_slot_count);
+	return max(fill_bytes, fill_slots);
+}
+
+static void init_status(status_t &status)
+{
+	SecureZeroMemory(&status, sizeof(status_t));
+	status.time_start = status.time_ref = clock_now();
+	status.average_rate = -1.0;
+	status.entropy = MAXDWORD;
+}
+
+static LONG64 detect_size(const HANDLE handle)
+{
+	LARGE_INTEGER file_size, file_pos, zero;
+	GET_LENGTH_INFORMATION length_info;
+	DWORD bytes_returned;
+	zero.QuadPart = 0LL;
+	if((GetFileType(handle) != FILE_TYPE_DISK) || (!SetFilePointerEx(handle, zero, &file_pos, FILE_CURRENT)))
+	{
+		return -1LL; /*pipe or character device*/
+	}
+	if(!GetFileSizeEx(handle, &file_size))
+	{
+		if(!DeviceIoControl(handle, IOCTL_DISK_GET_LENGTH_INFO, NULL, 0U, &length_info, sizeof(GET_LENGTH_INFORMATION), &bytes_returned, NULL))
+		{
+			return -1LL;
+		}
+		file_size.QuadPart = length_info.Length.QuadPart; /*volume or physical drive*/
+	}
+	return max(0LL, file_size.QuadPart - file_pos.QuadPart);
+}
+
+static LONG64 detect_inputs_size(void)
+{
+	LONG64 total = 0LL;
+	for(DWORD index = 0U; index < g_input_count; ++index)
+	{
+		const LONG64 size = detect_size(g_inputs[index].handle);
+		if(size < 0LL)
+		{
+			return -1LL; /*one of them is a pipe*/
+		}
+		total += size;
+	}
+	return total;
+}
+
+static double estimate_rate(status_t &status, const double time, const double bytes)
+{
+	double sum_t = 0.0, sum_b = 0.0, sum_tt = 0.0, sum_tb = 0.0;
+	status.window_time[status.window_next] = time;
+	status.window_bytes[status.window_next] = bytes;
+	status.window_next = (status.window_next + 1U) % ETA_WINDOW;
+	status.window_count = min(status.window_count + 1U, ETA_WINDOW);
+	if(status.window_count < 3U)
+	{
+		return status.average_rate;
+	}
+	for(DWORD i = 0U; i < status.window_count; ++i)
+	{
+		const double t = status.window_time[i] - time; /*relative to now, for numerical stability*/
+		sum_t += t;
+		sum_b += status.window_bytes[i];
+		sum_tt += t * t;
+		sum_tb += t * status.window_bytes[i];
+	}
+	const double n = static_cast<double>(status.window_count), denominator = (n * sum_tt) - (sum_t * sum_t);
+	const double slope = (denominator > 0.0) ? (((n * sum_tb) - (sum_t * sum_b)) / denominator) : 0.0;
+	return (slope > 0.0) ? slope : status.average_rate; /*least-squares fit over the window*/
+}
+
+static void update_progress(status_t &status, const LONG64 time_now)
+{
+	const double rate = estimate_rate(status, static_cast<double>(time_now - status.time_start) / static_cast<double>(g_perf_freq.QuadPart), static_cast<double>(status.bytes_total));
+	const LONG64 remaining = max(0LL, g_input_size - status.bytes_total);
+	status.progress = g_input_size ? permille(g_input_size - remaining, g_input_size) : 1000U;
+	status.eta = (!remaining) ? 0LL : ((rate > 0.0) ? round64(static_cast<double>(remaining) / rate) : -1LL);
+}
+
+static bool update_status(status_t &status)
+{
+	const LONG64 time_now = clock_now();
+	if(time_now > status.time_ref)
+	{
+		const LONG64 stall_read = InterlockedExchangeAdd64(&g_producer.stall_ticks, 0LL), stall_write = InterlockedExchangeAdd64(&g_outputs[0U].cursor.stall_ticks, 0LL);
+		const LONG64 bytes_total = InterlockedExchangeAdd64(&g_bytes_transferred, 0LL);
+		status.bytes_current = bytes_total - status.bytes_total;
+		status.bytes_total = bytes_total;
+		status.current_rate = static_cast<double>(status.bytes_current) / (static_cast<double>(time_now - status.time_ref) / static_cast<double>(g_perf_freq.QuadPart));
+		status.average_rate = (status.average_rate < 0.0) ? status.current_rate : ((status.current_rate * update) + (status.average_rate * (1.0 - update)));
+		status.stall_read_current = permille(stall_read - status.stall_read, time_now - status.time_ref);
+		status.stall_write_current = permille(stall_write - status.stall_write, time_now - status.time_ref);
+		status.fill_sum += (status.fill = ring_fill());
+		++status.fill_samples;
+		status.stall_read = stall_read;
+		status.stall_write = stall_write;
+		if(g_options.count_records)
+		{
+			const LONG64 records_total = InterlockedExchangeAdd64(&g_records_total, 0LL);
+			const double record_rate = static_cast<double>(records_total - status.records_total) / (static_cast<double>(time_now - status.time_ref) / static_cast<double>(g_perf_freq.QuadPart));
+			status.record_rate = (!status.records_total) ? record_rate : ((record_rate * update) + (status.record_rate * (1.0 - update)));
+			status.records_total = records_total;
+		}
+		if(g_options.entropy)
+		{
+			LONG64 counts[256U];
+			content_snapshot(&g_content, counts);
+			const DWORD entropy = content_entropy(counts, status.content_base);
+			if(entropy != MAXDWORD)
+			{
+				status.entropy = entropy; /*keep the previous estimate for an idle interval*/
+			}
+			CopyMemory(status.content_base, counts, sizeof(counts));
+		}
+		if(g_input_size >= 0LL)
+		{
+			update_progress(status, time_now);
+		}
+		status.time_ref = time_now;
+		return true;
+	}
+	return false;
+}
+
+static void print_status(const HANDLE std_err, const status_t &status)
+{
+	char buffer_bytes[32U], buffer_rate[32U], buffer_records[64U], buffer_entropy[32U], buffer_progress[48U];
+	buffer_records[0U] = buffer_entropy[0U] = buffer_progress[0U] = '\0';
+	if(g_options.entropy && (status.entropy != MAXDWORD))
+	{
+		wsprintfA(buffer_entropy, "[entropy %lu.%02lu bit/B] ", status.entropy / 1000U, (status.entropy % 1000U) / 10U);
+	}
+	if(g_options.count_records)
+	{
+		char buffer_count[32U], buffer_count_rate[32U];
+		const char *const unit = (g_options.delimiter == '\n') ? "lines" : "records";
+		wsprintfA(buffer_records, "[%s %s, %s %s/s] ", format_count(buffer_count, status.records_total), unit, format_count(buffer_count_rate, round64(status.record_rate)), unit);
+	}
+	if(g_input_size >= 0LL)
+	{
+		if(status.eta >= 0LL)
+		{
+			wsprintfA(buffer_progress, "[%ld.%01ld%%, ETA %02lu:%02lu:%02lu] ", status.progress / 10U, status.progress % 10U, (DWORD) min(status.eta / 3600LL, 99999LL), (DWORD)((status.eta / 60LL) % 60LL), (DWORD)(status.eta % 60LL));
+		}
+		else
+		{
+			wsprintfA(buffer_progress, "[%ld.%01ld%%, ETA --:--:--] ", status.progress / 10U, status.progress % 10U);
+		}
+	}
+	print_text_fmt(std_err, "\r%s [%s/s] %s%s[full %ld%%, empty %ld%%, fill %ld%%] %s", format(buffer_bytes, status.bytes_total), format(buffer_rate, round64(status.average_rate)),
+		buffer_records, buffer_entropy, status.stall_read_current / 10U, status.stall_write_current / 10U, status.fill / 10U, buffer_progress);
+}
+
+static void print_outputs(const HANDLE std_err)
+{
+	char buffer[32U], buffer_zero[32U], buffer_regions[24U];
+	if(g_options.output_count > 0U)
+	{
+		for(DWORD index = 0U; index <= g_options.output_count; ++index)
+		{
+			print_text_fmt(std_err, "Output \"%S\": %s%s\n", g_outputs[index].name, format(buffer, g_outputs[index].bytes_written), g_outputs[index].active ? "" : " (dropped)");
+		}
+	}
+	for(DWORD index = 0U; index <= g_options.output_count; ++index)
+	{
+		if(const sparse_t *const sparse = g_outputs[index].sparse)
+		{
+			print_text_fmt(std_err, "Sparse \"%S\": %s of zeros skipped in %s regions\n", g_outputs[index].name, format(buffer_zero, sparse->zero_bytes), format_int(buffer_regions, sparse->regions));
+		}
+	}
+}
+
+/* ======================================================================= */
+/* Statistics stream                                                       */
+/* ======================================================================= */
+
+static const char *const STATS_HEADER = "timestamp,elapsed_ms,bytes_total,bytes_interval,rate,rate_avg,fill,reader_blocked,writer_blocked\r\n";
+
+static bool open_stats(status_t &status)
+{
+	DWORD bytes_written;
+	if((status.stats_file = CreateFileW(g_options.stats_file, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+	{
+		status.stats_file = CreateFileW(g_options.stats_file, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); /*pipe or device*/
+	}
+	if(status.stats_file == INVALID_HANDLE_VALUE)
+	{
+		status.stats_file = NULL;
+		return false;
+	}
+	if(g_options.stats_format == STATS_CSV)
+	{
+		WriteFile(status.stats_file, STATS_HEADER, lstrlenA(STATS_HEADER), &bytes_written, NULL);
+	}
+	return true;
+}
+
+static void write_stats(const status_t &status)
+{
+	char line[512U], timestamp[32U], total[24U], current[24U], rate[24U], rate_avg[24U], elapsed[24U];
+	SYSTEMTIME time;
+	DWORD bytes_written;
+
+	if(!status.stats_file)
+	{
+		return;
+	}
+
+	GetSystemTime(&time);
+	wsprintfA(timestamp, "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ", time.wYear, time.wMonth, time.wDay, time.wHour, time.wMinute, time.wSecond, time.wMilliseconds);
+	format_int(elapsed, ((status.time_ref - status.time_start) * 1000LL) / g_perf_freq.QuadPart);
+	format_int(total, status.bytes_total);
+	format_int(current, status.bytes_current);
+	format_int(rate, round64(status.current_rate));
+	format_int(rate_avg, round64(status.average_rate));
+
+	if(g_options.stats_format == STATS_CSV)
+	{
+		wsprintfA(line, "%s,%s,%s,%s,%s,%s,%lu.%lu,%lu.%lu,%lu.%lu\r\n", timestamp, elapsed, total, current, rate, rate_avg,
+			status.fill / 10U, status.fill % 10U, status.stall_read_current / 10U, status.stall_read_current % 10U, status.stall_write_current / 10U, status.stall_write_current % 10U);
+	}
+	else
+	{
+		wsprintfA(line, "{\"timestamp\":\"%s\",\"elapsed_ms\":%s,\"bytes_total\":%s,\"bytes_interval\":%s,\"rate\":%s,\"rate_avg\":%s,\"fill\":%lu.%lu,\"reader_blocked\":%lu.%lu,\"writer_blocked\":%lu.%lu}\n",
+			timestamp, elapsed, total, current, rate, rate_avg,
+			status.fill / 10U, status.fill % 10U, status.stall_read_current / 10U, status.stall_read_current % 10U, status.stall_write_current / 10U, status.stall_write_current % 10U);
+	}
+
+	WriteFile(status.stats_file, line, lstrlenA(line), &bytes_written, NULL);
+}
+
+/* ======================================================================= */
+/* Status thread                                                           */
+/* ======================================================================= */
+
+static DWORD __stdcall status_thread(const LPVOID param)
+{
+	status_t *const status = (status_t*)param;
+	const HANDLE wait_handles[] = { status->done, status->timer };
+	LARGE_INTEGER due_time;
+
+	due_time.QuadPart = -10000LL * g_options.status_interval;
+	if(!SetWaitableTimer(status->timer, &due_time, g_options.status_interval, NULL, NULL, FALSE))
+	{
+		return 1U;
+	}
+
+	while(WaitForMultipleObjects(2U, wait_handles, FALSE, INFINITE) == WAIT_OBJECT_0 + 1U)
+	{
+		if(update_status(*status))
+		{
+			print_status(status->std_err, *status);
+			write_stats(*status);
+		}
+		if(InterlockedExchange(&g_trace_request, 0L))
+		{
+			print_text(status->std_err, "\n");
+			print_trace(status->std_err);
+		}
+	}
+
+	CancelWaitableTimer(status->timer);
+	return 0U;
+}
+
+static void print_summary(const HANDLE std_err, const status_t &status)
+{
+	const LONG64 elapsed = status.time_ref - status.time_start;
+	if((elapsed > 0LL) && (status.fill_samples > 0U))
+	{
+		const DWORD stall_read = permille(status.stall_read, elapsed), stall_write = permille(status.stall_write, elapsed);
+		const DWORD fill = (DWORD)(status.fill_sum / status.fill_samples);
+		print_text_fmt(std_err, "\nReader blocked on full buffer: %ld.%01ld%%, writer blocked on empty buffer: %ld.%01ld%%, average fill: %ld.%01ld%%\n",
+			stall_read / 10U, stall_read % 10U, stall_write / 10U, stall_write % 10U, fill / 10U, fill % 10U);
+		if(stall_read > stall_write)
+		{
+			print_text(std_err, "Bottleneck: consumer (the output side could not keep up)\n");
+		}
+		else if(stall_write > stall_read)
+		{
+			print_text(std_err, "Bottleneck: producer (the input side could not keep up)\n");
+		}
+	}
+	else
+	{
+		print_text(std_err, "\n");
+	}
+	if(g_options.count_records)
+	{
+		char buffer[24U];
+		print_text_fmt(std_err, "%s: %s%s\n", (g_options.delimiter == '\n') ? "Lines" : "Records", format_int(buffer, InterlockedExchangeAdd64(&g_records_total, 0LL)), g_records_done ? " (limit reached)" : "");
+	}
+	if(g_options.entropy)
+	{
+		LONG64 counts[256U];
+		content_snapshot(&g_content, counts);
+		const DWORD entropy = content_entropy(counts, NULL);
+		if(entropy != MAXDWORD)
+		{
+			print_text_fmt(std_err, "Entropy: %lu.%03lu bits per byte%s\n", entropy / 1000U, entropy % 1000U, (entropy >= ENTROPY_DENSE) ? " (looks compressed or encrypted)" : "");
+		}
+	}
+}
+
+/* ======================================================================= */
+/* Throughput recorder                                                     */
+/* ======================================================================= */
+
+#define RECORD_VERSION 1U
+#define RECORD_BATCH 4096U
+
+static const BYTE RECORD_MAGIC[8U] = { 'P', 'V', 'R', 'E', 'C', 'O', 'R', 'D' };
+
+typedef struct record_header_t
+{
+	BYTE magic[8U];
+	DWORD version, entry_size;
+	DWORD interval, reserved;
+	LONG64 start_time; /*FILETIME, UTC*/
+}
+record_header_t;
+
+typedef struct record_entry_t
+{
+	DWORD time_delta;  /*usec since previous entry, zero for a continuation*/
+	DWORD bytes_delta;
+	WORD fill, read_blocked, write_blocked, reserved; /*permille*/
+}
+record_entry_t;
+
+typedef struct recorder_t
+{
+	HANDLE file, timer, done;
+	record_entry_t *buffer;
+	OVERLAPPED request[2U];
+	bool pending[2U];
+	DWORD half, count;
+	LONG64 offset;
+	LONG64 time_start, usec_ref, bytes_ref, stall_read_ref, stall_write_ref;
+}
+recorder_t;
+
+static bool record_wait(recorder_t *const rec, const DWORD half)
+{
+	DWORD bytes_written;
+	if(rec->pending[half])
+	{
+		rec->pending[half] = false;
+		return GetOverlappedResult(rec->file, &rec->request[half], &bytes_written, TRUE) ? true : false;
+	}
+	return true;
+}
+
+static bool record_write(recorder_t *const rec, const DWORD half, const void *const data, const DWORD length)
+{
+	OVERLAPPED *const request = &rec->request[half];
+	const HANDLE event = request->hEvent;
+	SecureZeroMemory(request, sizeof(OVERLAPPED));
+	request->hEvent = event;
+	request->Offset = (DWORD)rec->offset;
+	request->OffsetHigh = (DWORD)(rec->offset >> 32);
+	if((!WriteFile(rec->file, data, length, NULL, request)) && (GetLastError() != ERROR_IO_PENDING))
+	{
+		return false;
+	}
+	rec->offset += length;
+	rec->pending[half] = true;
+	return true;
+}
+
+static void record_flush(recorder_t *const rec)
+{
+	if(rec->count > 0U)
+	{
+		record_write(rec, rec->half, rec->buffer + (rec->half * RECORD_BATCH), rec->count * sizeof(record_entry_t));
+		rec->half ^= 1U;
+		rec->count = 0U;
+		record_wait(rec, rec->half); /*the other half must be written before it can be reused*/
+	}
+}
+
+static void record_sample(recorder_t *const rec)
+{
+	const LONG64 time_now = clock_now();
+	const LONG64 usec_now = (LONG64)((static_cast<double>(time_now - rec->time_start) / static_cast<double>(g_perf_freq.QuadPart)) * 1000000.0);
+	const LONG64 bytes_now = InterlockedExchangeAdd64(&g_bytes_transferred, 0LL);
+	const LONG64 stall_read = InterlockedExchangeAdd64(&g_producer.stall_ticks, 0LL), stall_write = InterlockedExchangeAdd64(&g_outputs[0U].cursor.stall_ticks, 0LL);
+	const LONG64 elapsed = (LONG64)((static_cast<double>(usec_now - rec->usec_ref) / 1000000.0) * static_cast<double>(g_perf_freq.QuadPart));
+
+	ULONG64 time_delta = (ULONG64) max(0LL, usec_now - rec->usec_ref), bytes_delta = (ULONG64)(bytes_now - rec->bytes_ref);
+	const WORD fill = (WORD)ring_fill(), read_blocked = (WORD)permille(stall_read - rec->stall_read_ref, elapsed), write_blocked = (WORD)permille(stall_write - rec->stall_write_ref, elapsed);
+
+	do
+	{
+		record_entry_t *const entry = rec->buffer + (rec->half * RECORD_BATCH) + rec->count;
+		entry->time_delta = (DWORD) min(time_delta, MAXDWORD);
+		entry->bytes_delta = (DWORD) min(bytes_delta, MAXDWORD);
+		entry->fill = fill;
+		entry->read_blocked = read_blocked;
+		entry->write_blocked = write_blocked;
+		entry->reserved = 0U;
+		time_delta -= entry->time_delta;
+		bytes_delta -= entry->bytes_delta;
+		if(++rec->count >= RECORD_BATCH)
+		{
+			record_flush(rec);
+		}
+	}
+	while((time_delta > 0U) || (bytes_delta > 0U)); /*counters that overflow are split into continuation entries*/
+
+	rec->usec_ref = usec_now;
+	rec->bytes_ref = bytes_now;
+	rec->stall_read_ref = stall_read;
+	rec->stall_write_ref = stall_write;
+}
+
+static bool record_open(recorder_t *const rec, const HANDLE done)
+{
+	record_header_t header;
+	FILETIME start_time;
+
+	rec->done = done;
+	if(!(rec->buffer = (record_entry_t*) LocalAlloc(LPTR, 2U * RECORD_BATCH * sizeof(record_entry_t))))
+	{
+		return false;
+	}
+	for(DWORD half = 0U; half < 2U; ++half)
+	{
+		if(!(rec->request[half].hEvent = CreateEventW(NULL, TRUE, FALSE, NULL)))
+		{
+			return false;
+		}
+	}
+	if(!(rec->timer = CreateWaitableTimerW(NULL, FALSE, NULL)))
+	{
+		return false;
+	}
+	if((rec->file = CreateFileW(g_options.record_file, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL)) == INVALID_HANDLE_VALUE)
+	{
+		rec->file = NULL;
+		return false;
+	}
+
+	GetSystemTimeAsFileTime(&start_time);
+	SecureZeroMemory(&header, sizeof(record_header_t));
+	CopyMemory(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+	header.version = RECORD_VERSION;
+	header.entry_size = sizeof(record_entry_t);
+	header.interval = g_options.record_interval;
+	header.start_time = (((LONG64)start_time.dwHighDateTime) << 32) | start_time.dwLowDateTime;
+
+	rec->time_start = clock_now();
+	return record_write(rec, 0U, &header, sizeof(record_header_t)) && record_wait(rec, 0U);
+}
+
+static void record_close(recorder_t *const rec)
+{
+	for(DWORD half = 0U; half < 2U; ++half)
+	{
+		if(rec->file)
+		{
+			record_wait(rec, half);
+		}
+		if(rec->request[half].hEvent)
+		{
+			CloseHandle(rec->request[half].hEvent);
+		}
+	}
+	if(rec->file)
+	{
+		CloseHandle(rec->file);
+	}
+	if(rec->timer)
+	{
+		CloseHandle(rec->timer);
+	}
+	if(rec->buffer)
+	{
+		LocalFree(rec->buffer);
+	}
+}
+
+static DWORD __stdcall record_thread(const LPVOID param)
+{
+	recorder_t *const rec = (recorder_t*)param;
+	const HANDLE wait_handles[] = { rec->done, rec->timer };
+	LARGE_INTEGER due_time;
+
+	due_time.QuadPart = -10000LL * g_options.record_interval;
+	if(!SetWaitableTimer(rec->timer, &due_time, g_options.record_interval, NULL, NULL, FALSE))
+	{
+		return 1U;
+	}
+
+	for(;;)
+	{
+		const DWORD wait_status = WaitForMultipleObjects(2U, wait_handles, FALSE, INFINITE);
+		record_sample(rec);
+		if(wait_status != WAIT_OBJECT_0 + 1U)
+		{
+			break;
+		}
+	}
+
+	CancelWaitableTimer(rec->timer);
+	record_flush(rec);
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Replay                                                                  */
+/* ======================================================================= */
+
+#define REPLAY_GAPS 5U
+#define REPLAY_BLOCKED 500U
+
+typedef struct window_t
+{
+	ULONG64 start, length;
+}
+window_t;
+
+typedef struct stall_windows_t
+{
+	ULONG64 current_start, current_length;
+	ULONG64 total;
+	DWORD count;
+	window_t longest;
+}
+stall_windows_t;
+
+static void window_update(stall_windows_t &windows, const bool stalled, const ULONG64 position, const ULONG64 length)
+{
+	if(stalled)
+	{
+		if(!windows.current_length)
+		{
+			windows.current_start = position;
+		}
+		windows.current_length += length;
+		windows.total += length;
+	}
+	else if(windows.current_length > 0U)
+	{
+		++windows.count;
+		if(windows.current_length > windows.longest.length)
+		{
+			windows.longest.start = windows.current_start;
+			windows.longest.length = windows.current_length;
+		}
+		windows.current_length = 0U;
+	}
+}
+
+static void gap_insert(window_t *const gaps, const window_t &gap)
+{
+	for(DWORD i = 0U; i < REPLAY_GAPS; ++i)
+	{
+		if(gap.length > gaps[i].length)
+		{
+			for(DWORD j = REPLAY_GAPS - 1U; j > i; --j)
+			{
+				gaps[j] = gaps[j - 1U];
+			}
+			gaps[i] = gap;
+			return;
+		}
+	}
+}
+
+static CHAR *format_usec(CHAR *const buffer, const ULONG64 usec)
+{
+	const ULONG64 msec = usec / 1000U;
+	wsprintfA(buffer, "%02lu:%02lu:%02lu.%03lu", (DWORD)(msec / 3600000U), (DWORD)((msec / 60000U) % 60U), (DWORD)((msec / 1000U) % 60U), (DWORD)(msec % 1000U));
+	return buffer;
+}
+
+static void print_windows(const HANDLE output, const char *const name, const stall_windows_t &windows)
+{
+	char buffer_total[32U], buffer_start[32U], buffer_length[32U];
+	print_text_fmt(output, "%s: %lu windows, total %s", name, windows.count, format_usec(buffer_total, windows.total));
+	if(windows.count > 0U)
+	{
+		print_text_fmt(output, ", longest %s at %s", format_usec(buffer_length, windows.longest.length), format_usec(buffer_start, windows.longest.start));
+	}
+	print_text(output, "\n");
+}
+
+static bool check_magic(const record_header_t &header)
+{
+	for(DWORD i = 0U; i < sizeof(RECORD_MAGIC); ++i)
+	{
+		if(header.magic[i] != RECORD_MAGIC[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static UINT replay(const HANDLE output, const HANDLE std_err, const WCHAR *const file_name)
+{
+	UINT result = 1U;
+	record_header_t header;
+	record_entry_t *entries = NULL;
+	histogram_t rates;
+	stall_windows_t consumer_windows, producer_windows;
+	window_t gaps[REPLAY_GAPS], gap = { 0U, 0U };
+	record_entry_t sample = { 0U, 0U, 0U, 0U, 0U, 0U };
+	ULONG64 position = 0U, bytes_total = 0U, samples = 0U, rate_min = MAXULONGLONG, sample_bytes = 0U, sample_time = 0U;
+	DWORD bytes_read;
+	FILETIME start_time;
+	SYSTEMTIME start_date;
+	char buffer[32U], buffer_rate[32U];
+
+	SecureZeroMemory(&rates, sizeof(histogram_t));
+	SecureZeroMemory(&consumer_windows, sizeof(stall_windows_t));
+	SecureZeroMemory(&producer_windows, sizeof(stall_windows_t));
+	SecureZeroMemory(gaps, sizeof(gaps));
+
+	const HANDLE file = CreateFileW(file_name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		print_text_fmt(std_err, "Error: Failed to open the recording \"%S\"!\n", file_name);
+		return 1U;
+	}
+
+	if(!(ReadFile(file, &header, sizeof(record_header_t), &bytes_read, NULL) && (bytes_read == sizeof(record_header_t)) && check_magic(header)
+		&& (header.version == RECORD_VERSION) && (header.entry_size == sizeof(record_entry_t))))
+	{
+		print_text(std_err, "Error: The file is not a valid pv recording!\n");
+		goto clean_up;
+	}
+
+	if(!(entries = (record_entry_t*) LocalAlloc(LPTR, RECORD_BATCH * sizeof(record_entry_t))))
+	{
+		print_text(std_err, "Error: Memory allocation has failed!\n");
+		goto clean_up;
+	}
+
+	/*continuation entries are merged into the sample they belong to*/
+	for(;;)
+	{
+		const bool done = !(ReadFile(file, entries, RECORD_BATCH * sizeof(record_entry_t), &bytes_read, NULL) && (bytes_read >= sizeof(record_entry_t)));
+		const DWORD count = done ? 1U : (bytes_read / sizeof(record_entry_t));
+		for(DWORD index = 0U; index < count; ++index)
+		{
+			if((!done) && (!entries[index].time_delta))
+			{
+				sample_bytes += entries[index].bytes_delta;
+				continue;
+			}
+			if(sample_time > 0U)
+			{
+				const ULONG64 rate = (ULONG64)((static_cast<double>(sample_bytes) / static_cast<double>(sample_time)) * 1000000.0);
+				hist_record(&rates, rate);
+				rate_min = min(rate, rate_min);
+				window_update(consumer_windows, (sample.read_blocked >= REPLAY_BLOCKED), position, sample_time);
+				window_update(producer_windows, (sample.write_blocked >= REPLAY_BLOCKED), position, sample_time);
+				if(!sample_bytes)
+				{
+					gap.start = gap.length ? gap.start : position;
+					gap.length += sample_time;
+				}
+				else if(gap.length > 0U)
+				{
+					gap_insert(gaps, gap);
+					gap.length = 0U;
+				}
+				position += sample_time;
+				bytes_total += sample_bytes;
+				++samples;
+			}
+			if(done)
+			{
+				break;
+			}
+			sample = entries[index];
+			sample_time = sample.time_delta;
+			sample_bytes = sample.bytes_delta;
+		}
+		if(done)
+		{
+			break;
+		}
+	}
+
+	window_update(consumer_windows, false, position, 0U);
+	window_update(producer_windows, false, position, 0U);
+	if(gap.length > 0U)
+	{
+		gap_insert(gaps, gap);
+	}
+
+	start_time.dwLowDateTime = (DWORD)header.start_time;
+	start_time.dwHighDateTime = (DWORD)(header.start_time >> 32);
+	FileTimeToSystemTime(&start_time, &start_date);
+
+	print_text_fmt(output, "Recording: %S\n", file_name);
+	print_text_fmt(output, "Started: %04u-%02u-%02u %02u:%02u:%02u UTC, resolution %lu ms\n", start_date.wYear, start_date.wMonth, start_date.wDay, start_date.wHour, start_date.wMinute, start_date.wSecond, header.interval);
+	print_text_fmt(output, "Duration: %s, samples: %lu, transferred: %s", format_usec(buffer, position), (DWORD) min(samples, MAXDWORD), format(buffer_rate, bytes_total));
+	print_text_fmt(output, ", average: %s/s\n\n", format(buffer, position ? (LONG64)((static_cast<double>(bytes_total) / static_cast<double>(position)) * 1000000.0) : 0LL));
+
+	if(samples > 0U)
+	{
+		print_text_fmt(output, "Rate -> min: %s/s,", format(buffer, rate_min));
+		for(DWORD i = 0U; i < ARRAYSIZE(TRACE_PERCENTILES); ++i)
+		{
+			print_text_fmt(output, " %s: %s/s,", TRACE_LABELS[i], format(buffer, hist_percentile(&rates, TRACE_PERCENTILES[i])));
+		}
+		print_text_fmt(output, " max: %s/s\n\n", format(buffer, rates.max_value));
+	}
+
+	print_windows(output, "Consumer-bound (reader blocked >= 50%)", consumer_windows);
+	print_windows(output, "Producer-bound (writer blocked >= 50%)", producer_windows);
+
+	print_text(output, "\nLongest zero-throughput gaps:\n");
+	for(DWORD i = 0U; i < REPLAY_GAPS; ++i)
+	{
+		if(gaps[i].length > 0U)
+		{
+			print_text_fmt(output, "   %lu. %s at %s\n", i + 1U, format_usec(buffer, gaps[i].length), format_usec(buffer_rate, gaps[i].start));
+		}
+		else if(!i)
+		{
+			print_text(output, "   (none)\n");
+		}
+	}
+
+	result = 0U;
+
+clean_up:
+
+	if(entries)
+	{
+		LocalFree(entries);
+	}
+
+	CloseHandle(file);
+	return result;
+}
+
+/* ======================================================================= */
+/* Ctrl+C handler routine                                                  */
+/* ======================================================================= */
+
+static void cancel_read(void)
+{
+	if(const HANDLE thread = g_thread_read)
+	{
+		CancelSynchronousIo(thread); /*wake up a blocking ReadFile()*/
+	}
+}
+
+BOOL WINAPI ctrl_handler_routine(const DWORD type)
+{
+	if((type == CTRL_BREAK_EVENT) && g_options.trace)
+	{
+		InterlockedExchange(&g_trace_request, 1L); /*print the histograms instead of stopping*/
+		return TRUE;
+	}
+	switch(type)
+	{
+	case CTRL_C_EVENT:
+	case CTRL_BREAK_EVENT:
+	case CTRL_CLOSE_EVENT:
+	case CTRL_LOGOFF_EVENT:
+	case CTRL_SHUTDOWN_EVENT:
+		InterlockedExchange(&g_aborted, 1L); /*do not wait for the paced output to drain*/
+		if(g_stopping)
+		{
+			SetEvent(g_stopping);
+			cancel_read();
+		}
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* ======================================================================= */
+/* Help screen                                                             */
+/* ======================================================================= */
+
+#define __VERSION_STR(X, Y, Z) #X "." #Y "." #Z
+#define _VERSION_STR(X, Y, Z) __VERSION_STR(X, Y, Z)
+#define VERSION_STR _VERSION_STR(PIPEUTILS_VERSION_MAJOR, PIPEUTILS_VERSION_MINOR, PIPEUTILS_VERSION_PATCH)
+
+#define __MAKE_STR(X) #X
+#define _MAKE_STR(X) __MAKE_STR(X)
+#define DEFAULT_COALESCE_TIME_STR _MAKE_STR(DEFAULT_COALESCE_TIME)
+#define DEFAULT_CHUNK_SIZE_STR _MAKE_STR(DEFAULT_CHUNK_SIZE)
+#define LATENCY_CHUNK_SIZE_STR _MAKE_STR(LATENCY_CHUNK_SIZE)
+#define DEFAULT_RING_SIZE_STR _MAKE_STR(DEFAULT_RING_SIZE)
+#define DEFAULT_STATUS_INTERVAL_STR _MAKE_STR(DEFAULT_STATUS_INTERVAL)
+#define DEFAULT_RECORD_INTERVAL_STR _MAKE_STR(DEFAULT_RECORD_INTERVAL)
+
+static void print_help_screen(const HANDLE output)
+{
+	print_text(output, "pv v" VERSION_STR " [" __DATE__ "], by LoRd_MuldeR <MuldeR2@GMX.de>\n\n");
+	print_text(output, "Measure the throughput of a pipe and the amount of data transferred.\n\n");
+	print_text(output, "Usage:\n");
+	print_text(output, "   pv.exe [options] < infile > outfile\n");
+	print_text(output, "   pv.exe [options] infile... > outfile\n\n");
+	print_text(output, "Options:\n");
+	print_text(output, "   -b <size>   Size of a single read (chunk), default is " DEFAULT_CHUNK_SIZE_STR " bytes\n");
+	print_text(output, "   -B <size>   Total size of the ring buffer, default is " DEFAULT_RING_SIZE_STR " bytes\n");
+	print_text(output, "   -P          Try to use large pages for the ring buffer\n");
+	print_text(output, "   -K          Lock the ring buffer into physical memory\n");
+	print_text(output, "   -q <n>      Keep up to <n> overlapped reads/writes in flight on disk files\n");
+	print_text(output, "   -D          Use direct (unbuffered) I/O on disk files, bypassing the cache\n");
+	print_text(output, "   -f <size>   Coalesce pipe reads until a slot holds at least <size> bytes\n");
+	print_text(output, "   -d <msec>   Deadline for coalescing a slot, default is " DEFAULT_COALESCE_TIME_STR " ms\n");
+	print_text(output, "   -s <size>   Expected size of the input, used for the progress and the ETA\n");
+	print_text(output, "   -w <h,l>    Start writing at <h>% buffer fill and pause again at <l>% (bursts)\n");
+	print_text(output, "   -y          Low-latency mode: " LATENCY_CHUNK_SIZE_STR " byte chunks, spin before sleeping\n");
+	print_text(output, "   -c <r,w>    Pin the read thread to CPU <r> and the write thread to CPU <w>\n");
+	print_text(output, "   -N <node>   Allocate the ring on NUMA node <node> and keep the threads there\n");
+	print_text(output, "   -Y          Run with real-time priority (requires SeIncreaseBasePriority)\n");
+	print_text(output, "   -L <rate>   Limit the output to <rate> bytes per second (paced, no bursts)\n");
+	print_text(output, "   -o <file>   Also write the stream to <file>, may be given multiple times\n");
+	print_text(output, "   -x <msec>   Drop an extra output that stalls the input for <msec> ms\n");
+	print_text(output, "   -Z          Write disk file outputs as sparse files, zero blocks become holes\n");
+	print_text(output, "   -H <algo>   Compute digests of the stream: crc32c, xxh64, sha256 (comma list)\n");
+	print_text(output, "   -G <file>   Write the digests to <file> instead of the console\n");
+	print_text(output, "   -l          Count the lines of the stream and report the rate in lines/s\n");
+	print_text(output, "   -e <byte>   Count records terminated by <byte> instead of lines, implies -l\n");
+	print_text(output, "   -z          Count records terminated by a NUL byte, implies -l\n");
+	print_text(output, "   -n <count>  Stop after <count> records have been passed through, implies -l\n");
+	print_text(output, "   -E          Keep a byte histogram and show the entropy of the stream\n");
+	print_text(output, "   -t          Record per-call latency histograms, Ctrl+Break prints them\n");
+	print_text(output, "   -i <msec>   Interval between status updates, default is " DEFAULT_STATUS_INTERVAL_STR " ms\n");
+	print_text(output, "   -S <file>   Write the periodic statistics to <file>, one record per line\n");
+	print_text(output, "   -F <fmt>    Format of the statistics, either \"json\" (default) or \"csv\"\n");
+	print_text(output, "   -r <file>   Record the throughput to a compact binary log file\n");
+	print_text(output, "   -R <msec>   Resolution of the recording, default is " DEFAULT_RECORD_INTERVAL_STR " ms\n\n");
+	print_text(output, "Run \"pv.exe --replay <file>\" to print a summary of a recorded log file.\n");
+	print_text(output, "With -L, write a new rate (or \"off\") to the pipe \\\\.\\pipe\\pv-<pid> to change the limit.\n\n");
+	print_text(output, "Set environment variable PV_FORCE_NOWAIT=1 to force \"async\" mode.\n");
+	print_text(output, "Set environment variable PV_FORCE_COPY=1 to disable memory-mapped input.\n");
+	print_text(output, "Set environment variable PV_CHUNKSIZE or PV_BUFFSIZE to change the defaults.\n\n");
+}
+
+/* ======================================================================= */
+/* Command-line options                                                    */
+/* ======================================================================= */
+
+#define OPTION_VALUE(N) (((N) < argc) ? parse_number(argv[(N)]) : 0U)
+
+static ULONG64 env_number(const HANDLE std_err, const WCHAR *const name)
+{
+	if(const WCHAR *const envstr = get_env_variable(name))
+	{
+		if(envstr[0U])
+		{
+			const ULONG64 value = parse_number(envstr);
+			if(value < 1U)
+			{
+				print_text_fmt(std_err, "Warning: %S is invalid -> ignoring!\n", name);
+			}
+			return value;
+		}
+	}
+	return 0U;
+}
+
+static DWORD parse_digests(const WCHAR *str)
+{
+	static const WCHAR *const NAMES[DIGEST_COUNT] = { L"crc32c", L"xxh64", L"sha256" };
+	DWORD digests = 0U;
+	while(*str)
+	{
+		WCHAR token[16U];
+		DWORD len = 0U, index = 0U;
+		for(; *str && (*str != L','); ++str)
+		{
+			if(len >= ARRAYSIZE(token) - 1U)
+			{
+				return 0U;
+			}
+			token[len++] = *str;
+		}
+		token[len] = L'\0';
+		for(; (index < DIGEST_COUNT) && lstrcmpiW(token, NAMES[index]); ++index);
+		if(index >= DIGEST_COUNT)
+		{
+			return 0U; /*unknown algorithm*/
+		}
+		digests |= 1U << index;
+		if(*str)
+		{
+			++str;
+		}
+	}
+	return digests;
+}
+
+static DWORD parse_list(const WCHAR *str, ULONG64 *const values, const DWORD max_count)
+{
+	DWORD count = 0U;
+	while(*str)
+	{
+		WCHAR token[24U];
+		DWORD len = 0U;
+		for(; *str && (*str != L','); ++str)
+		{
+			if(len >= ARRAYSIZE(token) - 1U)
+			{
+				return 0U;
+			}
+			token[len++] = *str;
+		}
+		token[len] = L'\0';
+		if((count >= max_count) || ((!(values[count] = parse_number(token))) && lstrcmpW(token, L"0")))
+		{
+			return 0U; /*too many or invalid values*/
+		}
+		++count;
+		if(*str)
+		{
+			++str;
+		}
+	}
+	return count;
+}
+
+static bool parse_options(const HANDLE std_err, const int argc, const LPWSTR *const argv)
+{
+	ULONG64 chunk_size = env_number(std_err, L"PV_CHUNKSIZE"), ring_size = env_number(std_err, L"PV_BUFFSIZE");
+
+	g_options.large_pages = false;
+	g_options.lock_memory = false;
+	g_options.queue_depth = 0U;
+	g_options.direct_io = false;
+	g_options.coalesce_size = 0U;
+	g_options.coalesce_time = DEFAULT_COALESCE_TIME;
+	g_options.trace = false;
+	g_options.status_interval = DEFAULT_STATUS_INTERVAL;
+	g_options.stats_file = NULL;
+	g_options.stats_format = 0U;
+	g_options.record_file = NULL;
+	g_options.record_interval = DEFAULT_RECORD_INTERVAL;
+	g_options.input_size = 0U;
+	g_options.rate_limit = 0U;
+	g_options.output_count = 0U;
+	g_options.drop_time = 0U;
+	g_options.digests = 0U;
+	g_options.digest_file = NULL;
+	g_options.count_records = false;
+	g_options.delimiter = '\n';
+	g_options.record_limit = 0U;
+	g_options.sparse = false;
+	g_options.entropy = false;
+	g_options.high_mark = g_options.low_mark = 0U;
+	g_options.low_latency = false;
+	g_options.cpu_count = 0U;
+	g_options.numa_node = NUMA_NO_PREFERRED_NODE;
+	g_options.realtime = false;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		ULONG64 value = 0U;
+		if(lstrcmpW(argv[i], L"-b") == 0)
+		{
+			if(!(chunk_size = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+		}
+		else if(lstrcmpW(argv[i], L"-B") == 0)
+		{
+			if(!(ring_size = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+		}
+		else if(lstrcmpW(argv[i], L"-P") == 0)
+		{
+			g_options.large_pages = true;
+		}
+		else if(lstrcmpW(argv[i], L"-K") == 0)
+		{
+			g_options.lock_memory = true;
+		}
+		else if(lstrcmpW(argv[i], L"-q") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.queue_depth = (DWORD) min(value, MAX_QUEUE_DEPTH);
+		}
+		else if(lstrcmpW(argv[i], L"-D") == 0)
+		{
+			g_options.direct_io = true;
+		}
+		else if(lstrcmpW(argv[i], L"-f") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.coalesce_size = (DWORD) min(value, MAXLONG);
+		}
+		else if(lstrcmpW(argv[i], L"-d") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.coalesce_time = (DWORD) min(value, MAXLONG);
+			if(!g_options.coalesce_size)
+			{
+				g_options.coalesce_size = MAXLONG;
+			}
+		}
+		else if(lstrcmpW(argv[i], L"-s") == 0)
+		{
+			if(!(g_options.input_size = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.input_size = min(g_options.input_size, MAXLONGLONG);
+		}
+		else if(lstrcmpW(argv[i], L"-w") == 0)
+		{
+			ULONG64 marks[2U];
+			const DWORD count = (++i < argc) ? parse_list(argv[i], marks, 2U) : 0U;
+			if(!(count && (marks[0U] > 0U) && (marks[0U] <= 100U) && ((count < 2U) || (marks[1U] < marks[0U]))))
+			{
+				print_text(std_err, "Error: Option \"-w\" requires \"HIGH[,LOW]\" in percent, with LOW below HIGH!\n");
+				return false;
+			}
+			g_options.high_mark = (DWORD)marks[0U];
+			g_options.low_mark = (count > 1U) ? (DWORD)marks[1U] : 0U;
+		}
+		else if(lstrcmpW(argv[i], L"-y") == 0)
+		{
+			g_options.low_latency = true;
+		}
+		else if(lstrcmpW(argv[i], L"-c") == 0)
+		{
+			ULONG64 cpus[2U];
+			if(!((++i < argc) && (g_options.cpu_count = parse_list(argv[i], cpus, 2U)) && (cpus[0U] < MAX_CPUS) && ((g_options.cpu_count < 2U) || (cpus[1U] < MAX_CPUS))))
+			{
+				print_text(std_err, "Error: Option \"-c\" requires \"CPU[,CPU]\" with valid processor numbers!\n");
+				return false;
+			}
+			g_options.cpus[0U] = (DWORD)cpus[0U];
+			g_options.cpus[1U] = (DWORD)cpus[1U]; /*only used with two values*/
+		}
+		else if(lstrcmpW(argv[i], L"-N") == 0)
+		{
+			ULONG64 node;
+			if(!((++i < argc) && (parse_list(argv[i], &node, 1U) == 1U) && (node < MAXBYTE)))
+			{
+				goto invalid_argument;
+			}
+			g_options.numa_node = (DWORD)node;
+		}
+		else if(lstrcmpW(argv[i], L"-Y") == 0)
+		{
+			g_options.realtime = true;
+		}
+		else if(lstrcmpW(argv[i], L"-L") == 0)
+		{
+			if(!(g_options.rate_limit = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.rate_limit = min(g_options.rate_limit, MAXLONGLONG);
+		}
+		else if(lstrcmpW(argv[i], L"-o") == 0)
+		{
+			if((++i >= argc) || (!argv[i][0U]))
+			{
+				goto invalid_argument;
+			}
+			if(g_options.output_count >= MAX_OUTPUTS - DIGEST_COUNT - 2U)
+			{
+				print_text(std_err, "Error: Too many outputs have been specified!\n");
+				return false;
+			}
+			g_options.outputs[g_options.output_count++] = argv[i];
+		}
+		else if(lstrcmpW(argv[i], L"-Z") == 0)
+		{
+			g_options.sparse = true;
+		}
+		else if(lstrcmpW(argv[i], L"-x") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.drop_time = (DWORD) min(value, MAXLONG);
+		}
+		else if(lstrcmpW(argv[i], L"-H") == 0)
+		{
+			if(!((++i < argc) && (g_options.digests = parse_digests(argv[i]))))
+			{
+				print_text(std_err, "Error: Option \"-H\" requires a list of \"crc32c\", \"xxh64\" or \"sha256\"!\n");
+				return false;
+			}
+		}
+		else if(lstrcmpW(argv[i], L"-G") == 0)
+		{
+			if((++i >= argc) || (!argv[i][0U]))
+			{
+				goto invalid_argument;
+			}
+			g_options.digest_file = argv[i];
+		}
+		else if(lstrcmpW(argv[i], L"-l") == 0)
+		{
+			g_options.count_records = true;
+		}
+		else if(lstrcmpW(argv[i], L"-e") == 0)
+		{
+			if(!((value = OPTION_VALUE(++i)) && (value <= 0xFF)))
+			{
+				goto invalid_argument;
+			}
+			g_options.delimiter = (BYTE)value;
+			g_options.count_records = true;
+		}
+		else if(lstrcmpW(argv[i], L"-z") == 0)
+		{
+			g_options.delimiter = 0x00;
+			g_options.count_records = true;
+		}
+		else if(lstrcmpW(argv[i], L"-n") == 0)
+		{
+			if(!(g_options.record_limit = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.count_records = true;
+		}
+		else if(lstrcmpW(argv[i], L"-E") == 0)
+		{
+			g_options.entropy = true;
+		}
+		else if(lstrcmpW(argv[i], L"-t") == 0)
+		{
+			g_options.trace = true;
+		}
+		else if(lstrcmpW(argv[i], L"-i") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.status_interval = (DWORD) max(MIN_STATUS_INTERVAL, min(value, MAXLONG));
+		}
+		else if(lstrcmpW(argv[i], L"-S") == 0)
+		{
+			if((++i >= argc) || (!argv[i][0U]))
+			{
+				goto invalid_argument;
+			}
+			g_options.stats_file = argv[i];
+		}
+		else if(lstrcmpW(argv[i], L"-r") == 0)
+		{
+			if((++i >= argc) || (!argv[i][0U]))
+			{
+				goto invalid_argument;
+			}
+			g_options.record_file = argv[i];
+		}
+		else if(lstrcmpW(argv[i], L"-R") == 0)
+		{
+			if(!(value = OPTION_VALUE(++i)))
+			{
+				goto invalid_argument;
+			}
+			g_options.record_interval = (DWORD) min(value, MAXLONG);
+		}
+		else if(lstrcmpW(argv[i], L"-F") == 0)
+		{
+			if((++i < argc) && (lstrcmpiW(argv[i], L"json") == 0))
+			{
+				g_options.stats_format = STATS_JSON;
+			}
+			else if((i < argc) && (lstrcmpiW(argv[i], L"csv") == 0))
+			{
+				g_options.stats_format = STATS_CSV;
+			}
+			else
+			{
+				print_text(std_err, "Error: Option \"-F\" requires either \"json\" or \"csv\" as argument!\n");
+				return false;
+			}
+		}
+		else if((argv[i][0U] != L'-') || (!argv[i][1U]))
+		{
+			if((!g_inputs) && (!(g_inputs = (input_t*) LocalAlloc(LPTR, argc * sizeof(input_t)))))
+			{
+				print_text(std_err, "Error: Memory allocation has failed!\n");
+				return false;
+			}
+			g_inputs[g_input_count++].name = argv[i]; /*input file, or "-" for stdin*/
+		}
+		else
+		{
+			print_text_fmt(std_err, "Error: Unknown option \"%S\" encountered!\n", argv[i]);
+			return false;
+		}
+		continue;
+	invalid_argument:
+		print_text_fmt(std_err, "Error: Option \"%S\" requires a valid non-zero argument!\n", argv[i - 1]);
+		return false;
+	}
+
+	if((ring_size > MAXULONG_PTR / 4U) || ((!ring_size) && (DEFAULT_RING_SIZE < chunk_size)) || (ring_size && (ring_size < chunk_size)))
+	{
+		print_text(std_err, "Error: The buffer size is invalid or smaller than the chunk size!\n");
+		return false;
+	}
+
+	g_options.chunk_size = chunk_size ? (DWORD) max(MIN_CHUNK_SIZE, min(chunk_size, MAXLONG)) : (g_options.low_latency ? LATENCY_CHUNK_SIZE : DEFAULT_CHUNK_SIZE);
+	g_options.ring_size = ring_size ? (ULONG_PTR) max(ring_size, g_options.chunk_size) : DEFAULT_RING_SIZE;
+	g_options.coalesce_size = min(g_options.coalesce_size, g_options.chunk_size);
+
+	return true;
+}
+
+/* ======================================================================= */
+/* Main                                                                    */
+/* ======================================================================= */
+
+static UINT _main(const int argc, const LPWSTR *const argv)
+{
+	UINT result = 1U;
+	HANDLE thread_read = NULL, thread_status = NULL, thread_record = NULL, thread_control = NULL, thread_prefetch = NULL;
+	HANDLE wait_handles[MAX_OUTPUTS + 2U];
+	DWORD wait_status = WAIT_FAILED, wait_count = 0U;
+	bool collect_lock = false;
+	ULONGLONG numa_mask = 0U;
+	status_t status;
+	recorder_t recorder;
+
+	const HANDLE std_inp = GetStdHandle(STD_INPUT_HANDLE);
+	const HANDLE std_out = GetStdHandle(STD_OUTPUT_HANDLE);
+	const HANDLE std_err = GetStdHandle(STD_ERROR_HANDLE);
+
+	init_status(status);
+	status.std_err = std_err;
+	SecureZeroMemory(&recorder, sizeof(recorder_t));
+
+	if ((std_inp == INVALID_HANDLE_VALUE) || (std_out == INVALID_HANDLE_VALUE))
+	{
+		goto clean_up;
+	}
 
 	if((argc >= 2) && ((lstrcmpW(argv[1], L"-h") == 0) || (lstrcmpW(argv[1], L"-?") == 0) || (lstrcmpW(argv[1], L"/?") == 0)))
 	{
@@ -385,30 +4137,184 @@ static UINT _main(const int argc, const LPWSTR *const argv)
 		goto clean_up;
 	}
 
-	if(!(QueryPerformanceFrequency(&perf_freq) && QueryPerformanceCounter(&time_ref)))
+	if((argc >= 2) && (lstrcmpW(argv[1], L"--replay") == 0))
+	{
+		if(argc != 3)
+		{
+			print_text(std_err, "Error: Option \"--replay\" requires exactly one file name!\n");
+			goto clean_up;
+		}
+		result = QueryPerformanceFrequency(&g_perf_freq) ? replay(std_out, std_err, argv[2]) : 1U;
+		goto clean_up;
+	}
+
+	if(!parse_options(std_err, argc, argv))
+	{
+		goto clean_up;
+	}
+
+	detect_cpu_features();
+
+	if(!(QueryPerformanceFrequency(&g_perf_freq) && clock_now()))
 	{
 		print_text(std_err, "Error: Failed to read performance counters!\n");
 		goto clean_up;
 	}
 
+	if(g_options.stats_file && (!open_stats(status)))
+	{
+		print_text_fmt(std_err, "Error: Failed to open the statistics file \"%S\"!\n", g_options.stats_file);
+		goto clean_up;
+	}
+
+	if(!((status.timer = CreateWaitableTimerW(NULL, FALSE, NULL)) && (status.done = CreateEventW(NULL, TRUE, FALSE, NULL))))
+	{
+		print_text(std_err, "Error: Failed to create the status timer!\n");
+		goto clean_up;
+	}
+
+	if(g_options.record_file && (!record_open(&recorder, status.done)))
+	{
+		print_text_fmt(std_err, "Error: Failed to create the recording \"%S\"!\n", g_options.record_file);
+		goto clean_up;
+	}
+
+	if(g_options.rate_limit)
+	{
+		g_limiter.rate = (LONG64)g_options.rate_limit;
+		if(!limiter_open())
+		{
+			print_text(std_err, "Error: Failed to create the rate limit control pipe!\n");
+			goto clean_up;
+		}
+		print_text_fmt(std_err, "Rate limit control pipe: %S\n", g_limiter.pipe_name);
+	}
+
 	if(!(g_stopping = CreateEventW(NULL, TRUE, FALSE, NULL)))
 	{
 		print_text(std_err, "Error: Failed to create 'stopping' event!\n");
 		goto clean_up;
 	}
 
-	if(!(g_slots_free = CreateSemaphoreW(NULL, SLOT_COUNT, SLOT_COUNT, NULL)))
+	if(g_options.numa_node != NUMA_NO_PREFERRED_NODE)
 	{
-		print_text(std_err, "Error: Failed to create 'slots_free' semaphore!\n");
+		ULONG highest_node;
+		if(!(GetNumaHighestNodeNumber(&highest_node) && (g_options.numa_node <= highest_node) && GetNumaNodeProcessorMask((UCHAR)g_options.numa_node, &numa_mask) && numa_mask))
+		{
+			print_text_fmt(std_err, "Error: NUMA node %lu does not exist on this system!\n", g_options.numa_node);
+			goto clean_up;
+		}
+	}
+
+	if(g_options.realtime)
+	{
+		enable_privilege(SE_INC_BASE_PRIORITY_NAME);
+		if(!(SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS) && (GetPriorityClass(GetCurrentProcess()) == REALTIME_PRIORITY_CLASS)))
+		{
+			print_text(std_err, "Warning: Real-time priority is not available, running with high priority!\n");
+			SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+		}
+	}
+
+	if(!(g_ring_base = ring_alloc(g_options.ring_size, g_options.large_pages, g_ring_mapping)))
+	{
+		print_text(std_err, "Error: Failed to allocate the ring buffer!\n");
+		goto clean_up;
+	}
+
+	if(numa_mask && (!g_options.large_pages))
+	{
+		ring_touch(g_ring_base, g_options.ring_size);
+	}
+
+	if(g_options.lock_memory && (!(g_options.large_pages || ring_lock(g_ring_base, g_options.ring_size))))
+	{
+		print_text(std_err, "Warning: Failed to lock the ring buffer into memory!\n");
+	}
+
+	g_slot_count = (DWORD) max(MIN_SLOT_COUNT, min(g_options.ring_size / 4096U, MAX_SLOT_COUNT));
+	if(!(g_slots = (slot_t*) LocalAlloc(LPTR, g_slot_count * sizeof(slot_t))))
+	{
+		print_text(std_err, "Error: Memory allocation has failed!\n");
 		goto clean_up;
 	}
 
-	if(!(g_slots_used = CreateSemaphoreW(NULL, 0U, SLOT_COUNT, NULL)))
+	if(!(g_producer.wakeup = CreateEventW(NULL, FALSE, FALSE, NULL)))
 	{
-		print_text(std_err, "Error: Failed to create 'slots_used' semaphore!\n");
+		print_text(std_err, "Error: Failed to create 'producer' event!\n");
 		goto clean_up;
 	}
 
+	InitializeCriticalSection(&g_collect_lock);
+	collect_lock = true;
+
+	for(DWORD index = 0U; index <= g_options.output_count; ++index)
+	{
+		output_t *const output = &g_outputs[g_output_count];
+		output->name = index ? g_options.outputs[index - 1U] : L"stdout";
+		output->trace = index ? NULL : &g_trace[TRACE_WRITE];
+		output->active = 1L;
+		if(!(output->cursor.wakeup = CreateEventW(NULL, FALSE, FALSE, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'consumer' event!\n");
+			goto clean_up;
+		}
+		if(index)
+		{
+			if((output->handle = CreateFileW(output->name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+			{
+				output->handle = CreateFileW(output->name, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL); /*pipe or device*/
+			}
+			if(output->handle == INVALID_HANDLE_VALUE)
+			{
+				output->handle = NULL;
+				CloseHandle(output->cursor.wakeup);
+				print_text_fmt(std_err, "Error: Failed to open the output \"%S\"!\n", output->name);
+				goto clean_up;
+			}
+		}
+		else
+		{
+			output->handle = std_out;
+		}
+		if(g_options.sparse)
+		{
+			output->sparse = sparse_open(output, std_err);
+		}
+		++g_output_count;
+	}
+
+	for(DWORD index = 0U; index < DIGEST_COUNT; ++index)
+	{
+		if(g_options.digests & (1U << index))
+		{
+			output_t *const output = &g_outputs[g_output_count];
+			output->name = L"digest";
+			output->active = 1L;
+			digest_init(output->digest = &g_digests[index], 1U << index);
+			if(!(output->cursor.wakeup = CreateEventW(NULL, FALSE, FALSE, NULL)))
+			{
+				print_text(std_err, "Error: Failed to create 'consumer' event!\n");
+				goto clean_up;
+			}
+			++g_output_count;
+		}
+	}
+
+	if(g_options.entropy)
+	{
+		output_t *const output = &g_outputs[g_output_count];
+		output->name = L"entropy";
+		output->active = 1L;
+		output->content = &g_content;
+		if(!(output->cursor.wakeup = CreateEventW(NULL, FALSE, FALSE, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'consumer' event!\n");
+			goto clean_up;
+		}
+		++g_output_count;
+	}
+
 	if(const WCHAR *const envstr = get_env_variable(L"PV_FORCE_NOWAIT"))
 	{
 		if(envstr[0U] && (GetFileType(std_inp) == FILE_TYPE_PIPE))
@@ -425,36 +4331,189 @@ static UINT _main(const int argc, const LPWSTR *const argv)
 		}
 	}
 
+	for(DWORD index = 0U; index < g_input_count; ++index)
+	{
+		input_t *const input = &g_inputs[index];
+		if(lstrcmpW(input->name, L"-") == 0)
+		{
+			input->handle = std_inp;
+			continue;
+		}
+		if((input->handle = CreateFileW(input->name, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE)
+		{
+			input->handle = NULL;
+			print_text_fmt(std_err, "Error: Failed to open the input \"%S\"!\n", input->name);
+			goto clean_up;
+		}
+	}
+
+	g_input_size = g_options.input_size ? (LONG64)g_options.input_size : (g_input_count ? detect_inputs_size() : detect_size(std_inp));
+
+	if(const WCHAR *const envstr = get_env_variable(L"PV_FORCE_COPY"))
+	{
+		if((lstrcmpiW(envstr, L"1") == 0) || (lstrcmpiW(envstr, L"yes") == 0) || (lstrcmpiW(envstr, L"true") == 0))
+		{
+			g_force_copy = true;
+		}
+	}
+
+	if(g_input_count > 1U)
+	{
+		prefetch_init();
+		if((g_prefetch.wakeup = CreateEventW(NULL, FALSE, FALSE, NULL)) && (!(thread_prefetch = CreateThread(NULL, 0U, prefetch_thread, NULL, 0U, NULL))))
+		{
+			print_text(std_err, "Warning: Failed to create 'prefetch' thread!\n");
+		}
+		if(thread_prefetch)
+		{
+			SetThreadPriority(thread_prefetch, THREAD_PRIORITY_BELOW_NORMAL);
+		}
+	}
+
 	if(!(thread_read = CreateThread(NULL, 0U, read_thread, std_inp, 0U, NULL)))
 	{
 		print_text(std_err, "Error: Failed to create 'read' thread!\n");
 		goto clean_up;
 	}
 
-	if(!(thread_write = CreateThread(NULL, 0U, write_thread, std_out, 0U, NULL)))
+	g_thread_read = thread_read;
+	SetThreadPriority(thread_read, g_options.realtime ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_ABOVE_NORMAL);
+	wait_handles[wait_count++] = thread_read;
+	if(g_options.cpu_count > 0U)
+	{
+		pin_thread(std_err, thread_read, g_options.cpus[0U]);
+	}
+	else if(numa_mask)
+	{
+		SetThreadAffinityMask(thread_read, (DWORD_PTR)numa_mask);
+	}
+
+	for(DWORD index = 0U; index < g_output_count; ++index)
+	{
+		if(!(g_outputs[index].thread = CreateThread(NULL, 0U, g_outputs[index].digest ? digest_thread : (g_outputs[index].content ? content_thread : write_thread), &g_outputs[index], 0U, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'write' thread!\n");
+			SetEvent(g_stopping);
+			goto clean_up;
+		}
+		SetThreadPriority(g_outputs[index].thread, (g_options.realtime && (!index)) ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_ABOVE_NORMAL);
+		wait_handles[wait_count++] = g_outputs[index].thread;
+		if((!index) && (g_options.cpu_count > 1U))
+		{
+			pin_thread(std_err, g_outputs[index].thread, g_options.cpus[1U]);
+		}
+		else if(numa_mask)
+		{
+			SetThreadAffinityMask(g_outputs[index].thread, (DWORD_PTR)numa_mask); /*consumers stay next to the ring*/
+		}
+	}
+
+	wait_handles[wait_count++] = g_stopping;
+
+	if(!(thread_status = CreateThread(NULL, 0U, status_thread, &status, 0U, NULL)))
 	{
-		print_text(std_err, "Error: Failed to create 'write' thread!\n");
+		print_text(std_err, "Error: Failed to create 'status' thread!\n");
+		SetEvent(g_stopping);
 		goto clean_up;
 	}
 
-	SetThreadPriority(thread_read,  THREAD_PRIORITY_ABOVE_NORMAL);
-	SetThreadPriority(thread_write, THREAD_PRIORITY_ABOVE_NORMAL);
+	if(g_options.rate_limit)
+	{
+		if(!(thread_control = CreateThread(NULL, 0U, control_thread, status.done, 0U, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'control' thread!\n");
+			SetEvent(g_stopping);
+			goto clean_up;
+		}
+	}
+
+	if(g_options.record_file)
+	{
+		if(!(thread_record = CreateThread(NULL, 0U, record_thread, &recorder, 0U, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'record' thread!\n");
+			SetEvent(g_stopping);
+			goto clean_up;
+		}
+		SetThreadPriority(thread_record, THREAD_PRIORITY_HIGHEST);
+	}
+
+	while((wait_status = WaitForMultipleObjects(wait_count, wait_handles, TRUE, 1000U)) == WAIT_TIMEOUT)
+	{
+		if(WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0)
+		{
+			cancel_read(); /*the reader may have entered a new read after the first attempt*/
+		}
+	}
 
-	const HANDLE wait_handles[] =
+	SetEvent(status.done);
+	WaitForSingleObject(thread_status, INFINITE);
+	if(thread_record)
 	{
-		thread_read, thread_write, g_stopping
-	};
+		WaitForSingleObject(thread_record, INFINITE);
+	}
 
-	while((wait_status = WaitForMultipleObjects(3U, wait_handles, TRUE, 2500U)) == WAIT_TIMEOUT)
+	result = (wait_status == WAIT_OBJECT_0 + wait_count - 1U) ? 130U : 0U;
+	if(update_status(status))
 	{
-		print_status(std_err, time_now, time_ref, perf_freq, average_rate, bytes_total);
+		print_status(std_err, status);
+		write_stats(status);
 	}
+	print_summary(std_err, status);
+	print_outputs(std_err);
+	print_trace(std_err);
 
-	result = (wait_status == WAIT_OBJECT_0 + 2U) ? 130U : 0U;
-	print_status(std_err, time_now, time_ref, perf_freq, average_rate, bytes_total);
+	if(g_options.digests && (!g_aborted))
+	{
+		if(g_options.digest_file)
+		{
+			const HANDLE digest_file = CreateFileW(g_options.digest_file, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+			if(digest_file == INVALID_HANDLE_VALUE)
+			{
+				print_text_fmt(std_err, "Error: Failed to create the digest file \"%S\"!\n", g_options.digest_file);
+				result = 1U;
+			}
+			else
+			{
+				print_digests(digest_file);
+				CloseHandle(digest_file);
+			}
+		}
+		else
+		{
+			print_digests(std_err);
+		}
+	}
 
 clean_up:
 
+	g_thread_read = NULL;
+
+	if(thread_status)
+	{
+		SetEvent(status.done);
+		WaitForSingleObject(thread_status, INFINITE);
+		CloseHandle(thread_status);
+	}
+
+	if(thread_record)
+	{
+		SetEvent(status.done);
+		WaitForSingleObject(thread_record, INFINITE);
+		CloseHandle(thread_record);
+	}
+
+	if(thread_control)
+	{
+		SetEvent(status.done);
+		WaitForSingleObject(thread_control, INFINITE);
+		CloseHandle(thread_control);
+	}
+
+	limiter_close();
+
+	record_close(&recorder);
+
 	if(thread_read)
 	{
 		if(WaitForSingleObject(thread_read, 1000U) == WAIT_TIMEOUT)
@@ -464,23 +4523,71 @@ clean_up:
 		CloseHandle(thread_read);
 	}
 
-	if(thread_write)
+	if(thread_prefetch)
+	{
+		SetEvent(g_stopping);
+		WaitForSingleObject(thread_prefetch, INFINITE);
+		CloseHandle(thread_prefetch);
+	}
+
+	if(g_prefetch.wakeup)
+	{
+		CloseHandle(g_prefetch.wakeup);
+	}
+
+	if(g_inputs)
+	{
+		for(DWORD index = 0U; index < g_input_count; ++index)
+		{
+			if(g_inputs[index].handle && (g_inputs[index].handle != std_inp))
+			{
+				CloseHandle(g_inputs[index].handle);
+			}
+		}
+		LocalFree(g_inputs);
+	}
+
+	for(DWORD index = 0U; index < g_output_count; ++index)
 	{
-		if(WaitForSingleObject(thread_write, 1000U) == WAIT_TIMEOUT)
+		output_t *const output = &g_outputs[index];
+		if(const HANDLE thread = output->thread)
+		{
+			if(WaitForSingleObject(thread, 1000U) == WAIT_TIMEOUT)
+			{
+				TerminateThread(thread, 1U);
+			}
+			output->thread = NULL;
+			CloseHandle(thread);
+		}
+		if(output->cursor.wakeup)
+		{
+			CloseHandle(output->cursor.wakeup);
+		}
+		if(index && output->handle && (!output->digest))
 		{
-			TerminateThread(thread_write, 1U);
+			CloseHandle(output->handle);
 		}
-		CloseHandle(thread_write);
 	}
 
-	if(g_slots_free)
+	if(collect_lock)
+	{
+		DeleteCriticalSection(&g_collect_lock);
+	}
+
+	if(g_slots)
 	{
-		CloseHandle(g_slots_free);
+		for(DWORD slot_index = 0; slot_index < g_slot_count; ++slot_index)
+		{
+			release_view(slot_index);
+		}
+		LocalFree(g_slots);
 	}
 
-	if(g_slots_used)
+	ring_release(g_ring_base, g_options.ring_size, g_ring_mapping);
+
+	if(g_producer.wakeup)
 	{
-		CloseHandle(g_slots_used);
+		CloseHandle(g_producer.wakeup);
 	}
 
 	if(g_stopping)
@@ -488,6 +4595,21 @@ clean_up:
 		CloseHandle(g_stopping);
 	}
 
+	if(status.timer)
+	{
+		CloseHandle(status.timer);
+	}
+
+	if(status.done)
+	{
+		CloseHandle(status.done);
+	}
+
+	if(status.stats_file)
+	{
+		CloseHandle(status.stats_file);
+	}
+
 	return result;
 }
 
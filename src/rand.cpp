@@ -8,11 +8,13 @@
 #define WIN32_LEAN_AND_MEAN 1
 #include <Windows.h>
 #include <ShellAPI.h>
+#include <intrin.h>
 
-#define BUFFSIZE (16384U / sizeof(DWORD))
-#define BUFFSIZE_BYTES (sizeof(DWORD) * BUFFSIZE)
+#define BLOCK_WORDS (262144U / sizeof(DWORD))
+#define BLOCK_SIZE_BYTES (sizeof(DWORD) * BLOCK_WORDS)
+#define RING_DEPTH 4U
+#define MAX_THREADS 64U
 
-static DWORD buffer[BUFFSIZE];
 static HANDLE g_stopping = NULL;
 
 /* ======================================================================= */
@@ -53,6 +55,24 @@ static void random_seed(random_t *const state)
 	state->counter = 0U;
 }
 
+static __inline DWORD mix32(DWORD h)
+{
+	h ^= h >> 16;
+	h *= 0x85EBCA6BU;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35U;
+	return h ^ (h >> 16);
+}
+
+static void random_seed_fixed(random_t *const state, const DWORD seed)
+{
+	state->a = mix32(seed + 0x9E3779B9U); /*bijective, so at most one word is zero*/
+	state->b = mix32(seed + 0x3C6EF372U);
+	state->c = mix32(seed + 0xDAA66D2BU);
+	state->d = mix32(seed + 0x78DDE6E4U);
+	state->counter = 0U;
+}
+
 static __forceinline DWORD random_next(random_t *const state)
 {
 	DWORD t = state->d;
@@ -67,6 +87,325 @@ static __forceinline DWORD random_next(random_t *const state)
 	return t + (state->counter += 362437U);
 }
 
+/* ======================================================================= */
+/* CPU features                                                            */
+/* ======================================================================= */
+
+#define CPU_SSE2   0x1U
+#define CPU_AVX2   0x2U
+#define CPU_AVX512 0x4U
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1700)
+#define HAVE_AVX2 1
+#endif
+#if defined(_MSC_VER) && (_MSC_VER >= 1911)
+#define HAVE_AVX512 1
+#endif
+
+static DWORD g_cpu_features = 0U;
+
+static void detect_cpu_features(void)
+{
+	int info[4U];
+	__cpuid(info, 0);
+	const int max_leaf = info[0U];
+	if(max_leaf >= 1)
+	{
+		__cpuid(info, 1);
+		g_cpu_features |= (info[3U] & (1 << 26)) ? CPU_SSE2 : 0U;
+#ifdef HAVE_AVX2
+		if((max_leaf >= 7) && ((info[2U] & 0x18000000) == 0x18000000))
+		{
+			const ULONG64 xcr0 = _xgetbv(0U);
+			__cpuidex(info, 7, 0);
+			g_cpu_features |= ((info[1U] & (1 << 5)) && ((xcr0 & 0x6U) == 0x6U)) ? CPU_AVX2 : 0U;
+#ifdef HAVE_AVX512
+			g_cpu_features |= ((info[1U] & (1 << 16)) && ((xcr0 & 0xE6U) == 0xE6U)) ? CPU_AVX512 : 0U; /*the OS must also save the ZMM registers*/
+#endif
+		}
+#endif
+	}
+}
+
+/* ======================================================================= */
+/* Multi-lane generator                                                    */
+/* ======================================================================= */
+
+#define LANES 16U
+#define LANES_BLOCK (4U * LANES) /*four steps bring the state back in order*/
+
+typedef struct __declspec(align(64)) lanes_t
+{
+	DWORD a[LANES], b[LANES], c[LANES], d[LANES];
+	DWORD counter[LANES];
+}
+lanes_t;
+
+typedef void (*random_fill_t)(lanes_t *const lanes, DWORD *const data, const DWORD count);
+
+static void lanes_seed(lanes_t *const lanes, random_t *const state)
+{
+	for(DWORD lane = 0U; lane < LANES; ++lane)
+	{
+		do
+		{
+			lanes->a[lane] = random_next(state);
+			lanes->b[lane] = random_next(state);
+			lanes->c[lane] = random_next(state);
+			lanes->d[lane] = random_next(state);
+		}
+		while((!lanes->a[lane]) && (!lanes->b[lane]) && (!lanes->c[lane]) && (!lanes->d[lane]));
+		lanes->counter[lane] = random_next(state);
+	}
+}
+
+static void random_fill_scalar(lanes_t *const lanes, DWORD *const data, const DWORD count)
+{
+	for(DWORD lane = 0U; lane < LANES; ++lane)
+	{
+		random_t state;
+		state.a = lanes->a[lane];
+		state.b = lanes->b[lane];
+		state.c = lanes->c[lane];
+		state.d = lanes->d[lane];
+		state.counter = lanes->counter[lane];
+		for(DWORD offset = lane; offset < count; offset += LANES)
+		{
+			data[offset] = random_next(&state);
+		}
+		lanes->a[lane] = state.a;
+		lanes->b[lane] = state.b;
+		lanes->c[lane] = state.c;
+		lanes->d[lane] = state.d;
+		lanes->counter[lane] = state.counter;
+	}
+}
+
+/*
+ * The SIMD versions run the very same recurrence as random_next(), one lane per
+ * state. Instead of shifting a..d after each step, four consecutive steps write
+ * the new word over the oldest one, so the state is in order again afterwards.
+ */
+
+#define XORWOW_SSE2(OLD, NEW, COUNTER, OUT) do \
+{ \
+	__m128i t = _mm_xor_si128((OLD), _mm_srli_epi32((OLD), 2)); \
+	t = _mm_xor_si128(t, _mm_slli_epi32(t, 1)); \
+	(OLD) = _mm_xor_si128(t, _mm_xor_si128((NEW), _mm_slli_epi32((NEW), 4))); \
+	(COUNTER) = _mm_add_epi32((COUNTER), increment); \
+	_mm_store_si128((__m128i*)(OUT), _mm_add_epi32((OLD), (COUNTER))); \
+} \
+while(0)
+
+static void random_fill_sse2(lanes_t *const lanes, DWORD *const data, const DWORD count)
+{
+	const __m128i increment = _mm_set1_epi32(362437);
+	__m128i a[LANES / 4U], b[LANES / 4U], c[LANES / 4U], d[LANES / 4U], counter[LANES / 4U];
+	for(DWORD v = 0U; v < LANES / 4U; ++v)
+	{
+		a[v] = _mm_load_si128((const __m128i*)&lanes->a[4U * v]);
+		b[v] = _mm_load_si128((const __m128i*)&lanes->b[4U * v]);
+		c[v] = _mm_load_si128((const __m128i*)&lanes->c[4U * v]);
+		d[v] = _mm_load_si128((const __m128i*)&lanes->d[4U * v]);
+		counter[v] = _mm_load_si128((const __m128i*)&lanes->counter[4U * v]);
+	}
+	for(DWORD offset = 0U; offset < count; offset += LANES_BLOCK)
+	{
+		for(DWORD v = 0U; v < LANES / 4U; ++v)
+		{
+			XORWOW_SSE2(d[v], a[v], counter[v], &data[offset + (4U * v)]);
+			XORWOW_SSE2(c[v], d[v], counter[v], &data[offset + LANES + (4U * v)]);
+			XORWOW_SSE2(b[v], c[v], counter[v], &data[offset + (2U * LANES) + (4U * v)]);
+			XORWOW_SSE2(a[v], b[v], counter[v], &data[offset + (3U * LANES) + (4U * v)]);
+		}
+	}
+	for(DWORD v = 0U; v < LANES / 4U; ++v)
+	{
+		_mm_store_si128((__m128i*)&lanes->a[4U * v], a[v]);
+		_mm_store_si128((__m128i*)&lanes->b[4U * v], b[v]);
+		_mm_store_si128((__m128i*)&lanes->c[4U * v], c[v]);
+		_mm_store_si128((__m128i*)&lanes->d[4U * v], d[v]);
+		_mm_store_si128((__m128i*)&lanes->counter[4U * v], counter[v]);
+	}
+}
+
+#ifdef HAVE_AVX2
+#define XORWOW_AVX2(OLD, NEW, COUNTER, OUT) do \
+{ \
+	__m256i t = _mm256_xor_si256((OLD), _mm256_srli_epi32((OLD), 2)); \
+	t = _mm256_xor_si256(t, _mm256_slli_epi32(t, 1)); \
+	(OLD) = _mm256_xor_si256(t, _mm256_xor_si256((NEW), _mm256_slli_epi32((NEW), 4))); \
+	(COUNTER) = _mm256_add_epi32((COUNTER), increment); \
+	_mm256_store_si256((__m256i*)(OUT), _mm256_add_epi32((OLD), (COUNTER))); \
+} \
+while(0)
+
+static void random_fill_avx2(lanes_t *const lanes, DWORD *const data, const DWORD count)
+{
+	const __m256i increment = _mm256_set1_epi32(362437);
+	__m256i a0 = _mm256_load_si256((const __m256i*)&lanes->a[0U]), a1 = _mm256_load_si256((const __m256i*)&lanes->a[8U]);
+	__m256i b0 = _mm256_load_si256((const __m256i*)&lanes->b[0U]), b1 = _mm256_load_si256((const __m256i*)&lanes->b[8U]);
+	__m256i c0 = _mm256_load_si256((const __m256i*)&lanes->c[0U]), c1 = _mm256_load_si256((const __m256i*)&lanes->c[8U]);
+	__m256i d0 = _mm256_load_si256((const __m256i*)&lanes->d[0U]), d1 = _mm256_load_si256((const __m256i*)&lanes->d[8U]);
+	__m256i counter0 = _mm256_load_si256((const __m256i*)&lanes->counter[0U]), counter1 = _mm256_load_si256((const __m256i*)&lanes->counter[8U]);
+	for(DWORD offset = 0U; offset < count; offset += LANES_BLOCK)
+	{
+		XORWOW_AVX2(d0, a0, counter0, &data[offset]);
+		XORWOW_AVX2(d1, a1, counter1, &data[offset + 8U]);
+		XORWOW_AVX2(c0, d0, counter0, &data[offset + LANES]);
+		XORWOW_AVX2(c1, d1, counter1, &data[offset + LANES + 8U]);
+		XORWOW_AVX2(b0, c0, counter0, &data[offset + (2U * LANES)]);
+		XORWOW_AVX2(b1, c1, counter1, &data[offset + (2U * LANES) + 8U]);
+		XORWOW_AVX2(a0, b0, counter0, &data[offset + (3U * LANES)]);
+		XORWOW_AVX2(a1, b1, counter1, &data[offset + (3U * LANES) + 8U]);
+	}
+	_mm256_store_si256((__m256i*)&lanes->a[0U], a0); _mm256_store_si256((__m256i*)&lanes->a[8U], a1);
+	_mm256_store_si256((__m256i*)&lanes->b[0U], b0); _mm256_store_si256((__m256i*)&lanes->b[8U], b1);
+	_mm256_store_si256((__m256i*)&lanes->c[0U], c0); _mm256_store_si256((__m256i*)&lanes->c[8U], c1);
+	_mm256_store_si256((__m256i*)&lanes->d[0U], d0); _mm256_store_si256((__m256i*)&lanes->d[8U], d1);
+	_mm256_store_si256((__m256i*)&lanes->counter[0U], counter0); _mm256_store_si256((__m256i*)&lanes->counter[8U], counter1);
+	_mm256_zeroupper();
+}
+#endif
+
+#ifdef HAVE_AVX512
+#define XORWOW_AVX512(OLD, NEW, COUNTER, OUT) do \
+{ \
+	__m512i t = _mm512_xor_si512((OLD), _mm512_srli_epi32((OLD), 2)); \
+	t = _mm512_xor_si512(t, _mm512_slli_epi32(t, 1)); \
+	(OLD) = _mm512_xor_si512(t, _mm512_xor_si512((NEW), _mm512_slli_epi32((NEW), 4))); \
+	(COUNTER) = _mm512_add_epi32((COUNTER), increment); \
+	_mm512_store_si512((OUT), _mm512_add_epi32((OLD), (COUNTER))); \
+} \
+while(0)
+
+static void random_fill_avx512(lanes_t *const lanes, DWORD *const data, const DWORD count)
+{
+	const __m512i increment = _mm512_set1_epi32(362437);
+	__m512i a = _mm512_load_si512(lanes->a), b = _mm512_load_si512(lanes->b), c = _mm512_load_si512(lanes->c), d = _mm512_load_si512(lanes->d);
+	__m512i counter = _mm512_load_si512(lanes->counter);
+	for(DWORD offset = 0U; offset < count; offset += LANES_BLOCK)
+	{
+		XORWOW_AVX512(d, a, counter, &data[offset]);
+		XORWOW_AVX512(c, d, counter, &data[offset + LANES]);
+		XORWOW_AVX512(b, c, counter, &data[offset + (2U * LANES)]);
+		XORWOW_AVX512(a, b, counter, &data[offset + (3U * LANES)]);
+	}
+	_mm512_store_si512(lanes->a, a);
+	_mm512_store_si512(lanes->b, b);
+	_mm512_store_si512(lanes->c, c);
+	_mm512_store_si512(lanes->d, d);
+	_mm512_store_si512(lanes->counter, counter);
+	_mm256_zeroupper();
+}
+#endif
+
+static random_fill_t select_random_fill(void)
+{
+#ifdef HAVE_AVX512
+	if(g_cpu_features & CPU_AVX512)
+	{
+		return random_fill_avx512;
+	}
+#endif
+#ifdef HAVE_AVX2
+	if(g_cpu_features & CPU_AVX2)
+	{
+		return random_fill_avx2;
+	}
+#endif
+	return (g_cpu_features & CPU_SSE2) ? random_fill_sse2 : random_fill_scalar;
+}
+
+/* ======================================================================= */
+/* Output ring                                                             */
+/* ======================================================================= */
+
+/*
+ * Block i of the output lives in slot i % slot_count and is generated by thread
+ * i % thread_count. Since the slot count is a multiple of the thread count, each
+ * slot has exactly one generator and one writer, which simply take turns.
+ */
+
+typedef struct slot_t
+{
+	DWORD *data;
+	HANDLE filled, emptied;
+}
+slot_t;
+
+typedef struct generator_t
+{
+	lanes_t lanes;
+	DWORD index;
+	HANDLE thread;
+}
+generator_t;
+
+static slot_t *g_slots = NULL;
+static DWORD *g_ring = NULL;
+static DWORD g_slot_count = 0U, g_thread_count = 0U;
+static random_fill_t g_random_fill = NULL;
+
+static DWORD __stdcall generator_thread(const LPVOID param)
+{
+	generator_t *const generator = (generator_t*)param;
+	for(DWORD slot_index = generator->index; ; slot_index = (slot_index + g_thread_count) % g_slot_count)
+	{
+		const HANDLE handles[] = { g_stopping, g_slots[slot_index].emptied };
+		if(WaitForMultipleObjects(2U, handles, FALSE, INFINITE) != WAIT_OBJECT_0 + 1U)
+		{
+			break;
+		}
+		g_random_fill(&generator->lanes, g_slots[slot_index].data, BLOCK_WORDS);
+		SetEvent(g_slots[slot_index].filled);
+	}
+	return 0U;
+}
+
+/* ======================================================================= */
+/* Parse integer                                                           */
+/* ======================================================================= */
+
+static bool parse_dword(const WCHAR *str, DWORD *const value)
+{
+	const DWORD base = ((str[0U] == L'0') && ((str[1U] == L'x') || (str[1U] == L'X'))) ? 16U : 10U;
+	if(base > 10U)
+	{
+		str += 2U;
+	}
+	if(!(*str))
+	{
+		return false;
+	}
+	for(*value = 0U; *str; ++str)
+	{
+		DWORD digit;
+		if((*str >= L'0') && (*str <= L'9'))
+		{
+			digit = *str - L'0';
+		}
+		else if((base > 10U) && (*str >= L'a') && (*str <= L'f'))
+		{
+			digit = (*str - L'a') + 10U;
+		}
+		else if((base > 10U) && (*str >= L'A') && (*str <= L'F'))
+		{
+			digit = (*str - L'A') + 10U;
+		}
+		else
+		{
+			return false;
+		}
+		if(*value > (MAXDWORD - digit) / base)
+		{
+			return false; /*overflow*/
+		}
+		*value = (*value * base) + digit;
+	}
+	return true;
+}
+
 /* ======================================================================= */
 /* Ctrl+C handler routine                                                  */
 /* ======================================================================= */
@@ -102,6 +441,11 @@ static void print_help_screen(const HANDLE output)
 	print_text(output, "rand v" VERSION_STR " [" __DATE__ "], by LoRd_MuldeR <MuldeR2@GMX.de>\n\n");
 	print_text(output, "Fast generator of pseudo-random bytes, using the \"xorwow\" method.\n");
 	print_text(output, "Output has been verified to pass the Dieharder test suite.\n\n");
+	print_text(output, "Usage:\n");
+	print_text(output, "   rand.exe [options] > outfile\n\n");
+	print_text(output, "Options:\n");
+	print_text(output, "   -j <n>      Number of generator threads, default is 1 (up to 64)\n");
+	print_text(output, "   -s <seed>   Use a fixed 32-bit seed, output is reproducible for the same -j\n\n");
 }
 
 /* ======================================================================= */
@@ -111,18 +455,44 @@ static void print_help_screen(const HANDLE output)
 static UINT _main(const int argc, const LPWSTR *const argv)
 {
 	random_t state;
+	generator_t *generators = NULL;
+	DWORD thread_count = 1U, seed = 0U, started = 0U;
+	bool fixed_seed = false;
 	g_stopping = CreateEventW(NULL, TRUE, FALSE, NULL);
 	UINT result = 1U;
-	DWORD bytes_written = 0U;
-	BYTE check = 0U;
 
 	const HANDLE std_err = GetStdHandle(STD_ERROR_HANDLE);
 	const HANDLE std_out = GetStdHandle(STD_OUTPUT_HANDLE);
 
-	if((argc >= 2) && ((lstrcmpW(argv[1], L"-h") == 0) || (lstrcmpW(argv[1], L"-?") == 0) || (lstrcmpW(argv[1], L"/?") == 0)))
+	for(int i = 1; i < argc; ++i)
 	{
-		print_help_screen(std_err);
-		goto exit_loop;
+		if((lstrcmpW(argv[i], L"-h") == 0) || (lstrcmpW(argv[i], L"-?") == 0) || (lstrcmpW(argv[i], L"/?") == 0))
+		{
+			print_help_screen(std_err);
+			goto exit_loop;
+		}
+		else if((lstrcmpW(argv[i], L"-j") == 0) && (i + 1 < argc))
+		{
+			if((!parse_dword(argv[++i], &thread_count)) || (thread_count < 1U) || (thread_count > MAX_THREADS))
+			{
+				print_text(std_err, "Error: Invalid number of threads specified!\n");
+				goto exit_loop;
+			}
+		}
+		else if((lstrcmpW(argv[i], L"-s") == 0) && (i + 1 < argc))
+		{
+			if(!parse_dword(argv[++i], &seed))
+			{
+				print_text(std_err, "Error: Invalid seed value specified!\n");
+				goto exit_loop;
+			}
+			fixed_seed = true;
+		}
+		else
+		{
+			print_text(std_err, "Error: Unknown option encountered!\n");
+			goto exit_loop;
+		}
 	}
 
 	if (std_out == INVALID_HANDLE_VALUE)
@@ -133,27 +503,69 @@ static UINT _main(const int argc, const LPWSTR *const argv)
 
 	const bool is_pipe = (GetFileType(std_out) == FILE_TYPE_PIPE);
 
-	result = 0U;
-	random_seed(&state);
+	detect_cpu_features();
+	g_random_fill = select_random_fill();
 
-	for(;;)
+	g_thread_count = thread_count;
+	g_slot_count = RING_DEPTH * thread_count;
+
+	if(!((g_slots = (slot_t*) LocalAlloc(LPTR, g_slot_count * sizeof(slot_t))) && (g_ring = (DWORD*) VirtualAlloc(NULL, g_slot_count * BLOCK_SIZE_BYTES, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE)) && (generators = (generator_t*) VirtualAlloc(NULL, thread_count * sizeof(generator_t), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE))))
 	{
-		DWORD bytes_written = 0U, sleep_timeout = 0U;
-		if(!(++check))
+		print_text(std_err, "Error: Memory allocation has failed!\n");
+		goto exit_loop;
+	}
+
+	for(DWORD slot_index = 0U; slot_index < g_slot_count; ++slot_index)
+	{
+		slot_t *const slot = &g_slots[slot_index];
+		slot->data = g_ring + (slot_index * BLOCK_WORDS);
+		if(!((slot->filled = CreateEventW(NULL, FALSE, FALSE, NULL)) && (slot->emptied = CreateEventW(NULL, FALSE, TRUE, NULL))))
 		{
-			if(WaitForSingleObject(g_stopping, 0U) == WAIT_OBJECT_0)
-			{
-				result = 130U;
-				goto exit_loop;
-			}
+			print_text(std_err, "Error: Failed to create event object!\n");
+			goto exit_loop;
+		}
+	}
+
+	if(fixed_seed)
+	{
+		random_seed_fixed(&state, seed);
+	}
+	else
+	{
+		random_seed(&state);
+	}
+
+	for(DWORD index = 0U; index < thread_count; ++index)
+	{
+		generators[index].index = index;
+		lanes_seed(&generators[index].lanes, &state); /*distinct seeds, one stream per thread*/
+	}
+
+	for(; started < thread_count; ++started)
+	{
+		if(!(generators[started].thread = CreateThread(NULL, 0U, generator_thread, &generators[started], 0U, NULL)))
+		{
+			print_text(std_err, "Error: Failed to create 'generator' thread!\n");
+			goto exit_loop;
 		}
-		for (DWORD offset = 0U; offset < BUFFSIZE; ++offset)
+	}
+
+	result = 0U;
+
+	for(DWORD slot_index = 0U; ; slot_index = (slot_index + 1U) % g_slot_count)
+	{
+		DWORD bytes_written = 0U, sleep_timeout = 0U;
+		const HANDLE handles[] = { g_stopping, g_slots[slot_index].filled };
+		const DWORD wait_result = WaitForMultipleObjects(2U, handles, FALSE, INFINITE);
+		if(wait_result != WAIT_OBJECT_0 + 1U)
 		{
-			buffer[offset] = random_next(&state);
+			result = (wait_result == WAIT_OBJECT_0) ? 130U : 1U;
+			goto exit_loop;
 		}
-		for (DWORD offset = 0U; offset < BUFFSIZE_BYTES; offset += bytes_written)
+		const BYTE *const data = (const BYTE*) g_slots[slot_index].data;
+		for (DWORD offset = 0U; offset < BLOCK_SIZE_BYTES; offset += bytes_written)
 		{
-			if (!WriteFile(std_out, ((BYTE*)buffer) + offset, BUFFSIZE_BYTES - offset, &bytes_written, NULL))
+			if (!WriteFile(std_out, data + offset, BLOCK_SIZE_BYTES - offset, &bytes_written, NULL))
 			{
 				goto exit_loop; /*failed*/
 			}
@@ -174,10 +586,48 @@ static UINT _main(const int argc, const LPWSTR *const argv)
 				}
 			}
 		}
+		SetEvent(g_slots[slot_index].emptied);
 	}
 
 exit_loop:
 
+	if(g_stopping)
+	{
+		SetEvent(g_stopping);
+	}
+
+	for(DWORD index = 0U; index < started; ++index)
+	{
+		WaitForSingleObject(generators[index].thread, INFINITE);
+		CloseHandle(generators[index].thread);
+	}
+
+	if(g_slots)
+	{
+		for(DWORD slot_index = 0U; slot_index < g_slot_count; ++slot_index)
+		{
+			if(g_slots[slot_index].filled)
+			{
+				CloseHandle(g_slots[slot_index].filled);
+			}
+			if(g_slots[slot_index].emptied)
+			{
+				CloseHandle(g_slots[slot_index].emptied);
+			}
+		}
+		LocalFree(g_slots);
+	}
+
+	if(g_ring)
+	{
+		VirtualFree(g_ring, 0U, MEM_RELEASE);
+	}
+
+	if(generators)
+	{
+		VirtualFree(generators, 0U, MEM_RELEASE);
+	}
+
 	return result;
 }
 